@@ -1,20 +1,64 @@
 #include "precomp.h"
 #include "game.h"
+#include "stb_image.h"
 
 #define LINES		750
 #define LINEFILE	"lines750.dat"
+#define REFFILE		"assets/bird.png"
 #define ITERATIONS	16
+#define WU_FIXED	1											// 1: integer Wu blend, 0: reference double blend
+#define WU_LUT		1											// 1: integer Wu blend through lookup tables
+#define WU_BATCH	0											// 1: rasterize 8 lines in lockstep with AVX2
+#define SPAN_CACHE	1											// 1: replay cached line coverage instead of running the DDA
+#define WU_OCTANT	1											// 1: without SPAN_CACHE, use the specialized rasterizers
+#define FIT_COLOR	1											// 1: half of the color mutations fit the color to the reference
+#define DIRTY_RECT	1											// 1: re-render only the rectangle a mutation touches
+#define TILED_MT	1											// 1: render large line ranges in tiles on all cores
+#define SIMD_EVAL	1											// 1: score pixel runs with AVX2 / AVX-512 when available
+#define EVAL_BOUND	1											// 1: classic path rescans only changed rows, stops when rejected
+#define PYRAMID		1											// coarse levels a candidate must improve first: 0, 1 (2x), 2 (4x, 2x)
+#define EVAL_MT		1											// 1: score large regions in row bands on all cores
+#define METRIC_RGB	0
+#define METRIC_LAB	1
+#define METRIC_SSIM	2
+#define METRIC		METRIC_RGB									// fitness metric: METRIC_RGB, METRIC_LAB or METRIC_SSIM
+#define HOT_SAMPLE	1											// 1: new lines pick endpoints in proportion to tile error (DIRTY_RECT)
+#define ROI_MASK	1											// 1: pixels a mask gives weight 0 are not scored or rendered
+#define SAMPLE_EVAL	0											// 1: reject clear losses from a sample of rows (DIRTY_RECT)
+#define PREFIX_CACHE	1										// 1: classic path starts the prefix from a cached snapshot
+#define CANDIDATES	1											// mutations scored in parallel per step (DIRTY_RECT); 1: serial
+#define SPECULATIVE	0											// 1: candidates mutate different lines; all that don't overlap are kept
+#define ISLANDS		1											// genomes optimized independently on all cores (DIRTY_RECT); 1: off
+#define MIGRATE		8											// ticks between an island sending its genome to the next
+#define ACCEPT_HILL		0
+#define ACCEPT_ANNEAL	1
+#define ACCEPT		ACCEPT_HILL									// acceptance policy: ACCEPT_HILL or ACCEPT_ANNEAL
+#define COOLING_LINEAR		0
+#define COOLING_EXP			1
+#define COOLING_ADAPTIVE	2
+#define COOLING		COOLING_ADAPTIVE							// annealing schedule: COOLING_LINEAR, _EXP or _ADAPTIVE
+#define ANNEAL_T0	64.0f										// starting temperature, in fitness units
+#define ANNEAL_STEPS	2000000									// linear: mutations until the temperature reaches 0
+#define ANNEAL_ALPHA	0.999998								// exponential, adaptive: temperature factor per mutation
+#define ANNEAL_PATIENCE	200000									// adaptive: mutations without a new best before reheating
+#define SELF_CHECK	0											// 1: compare the fast paths with the reference ones at startup
 
 int lx1[LINES], ly1[LINES], lx2[LINES], ly2[LINES];			// lines: start and end coordinates
 uint lc[LINES];												// lines: colors
-int x1_, y1_, x2_, y2_;										// room for storing line backup
-uint c_;													// line color backup
+uint seed = 0x12345678;										// mutation random state of the serial optimizer
 int fitness;												// similarity to reference image
 int lidx = 0;												// current line to be mutated
 float peak = 0;												// peak line rendering performance
-Surface* reference, *backup;								// surfaces
+Surface* reference, *backup, *canvas;						// surfaces
 Timer timer;
 
+struct Rect { int x1, y1, x2, y2; };							// inclusive pixel bounds
+struct Line { int x1, y1, x2, y2; uint c; };					// one line of the genome, by value
+struct Mutation { int i; Line before; };						// line i was changed; what it replaced
+
+Line GetLine( int i ) { return { lx1[i], ly1[i], lx2[i], ly2[i], lc[i] }; }
+void SetLine( int i, const Line& l ) { lx1[i] = l.x1, ly1[i] = l.y1, lx2[i] = l.x2, ly2[i] = l.y2, lc[i] = l.c; }
+
 #define BYTE unsigned char
 #define DWORD unsigned int
 #define COLORREF DWORD
@@ -24,51 +68,270 @@ Timer timer;
 #define GetGValue(RGBColor) (BYTE) (((uint)RGBColor) >> 8)
 #define GetBValue(RGBColor) (BYTE) (((uint)RGBColor) >> 16)
 
+uint FitColor( int i, const Line& l, Surface* background );
+void HotPoint( int& x, int& y, uint& seed );
+
 // -----------------------------------------------------------
 // Mutate
-// Randomly modify or replace one line.
+// Randomly modify or replace line l, a copy of line i; all random
+// numbers come from 'seed', so candidates can be proposed on several
+// threads. If a background is given (a canvas line i can be drawn
+// on), color mutations may fit the color to the reference instead
+// of picking a random one.
 // -----------------------------------------------------------
-void MutateLine( int i )
+void Mutate( int i, Line& l, uint& seed, Surface* background = 0 )
 {
-	// backup the line before modifying it
-	x1_ = lx1[i], y1_ = ly1[i];
-	x2_ = lx2[i], y2_ = ly2[i];
-	c_ = lc[i];
 	do
 	{
-		if (rand() & 1)
+		if (RandomUInt( seed ) & 1)
 		{
-			// color mutation (50% probability)
-			lc[i] = RandomUInt() & 0xffffff;
+			// color mutation (50% probability); fitting needs a valid line,
+			// which an earlier pass of this loop may have left behind
+			const uint c = l.c;
+			const bool valid = abs( l.x1 - l.x2 ) >= 3 && abs( l.y1 - l.y2 ) >= 3;
+			if (FIT_COLOR && background && valid && (RandomUInt( seed ) & 1)) l.c = FitColor( i, l, background );
+			if (l.c == c) l.c = RandomUInt( seed ) & 0xffffff;
 		}
-		else if (rand() & 1)
+		else if (RandomUInt( seed ) & 1)
 		{
 			// small mutation (25% probability)
-			lx1[i] += RandomUInt() % 6 - 3, ly1[i] += RandomUInt() % 6 - 3;
-			lx2[i] += RandomUInt() % 6 - 3, ly2[i] += RandomUInt() % 6 - 3;
+			l.x1 += RandomUInt( seed ) % 6 - 3, l.y1 += RandomUInt( seed ) % 6 - 3;
+			l.x2 += RandomUInt( seed ) % 6 - 3, l.y2 += RandomUInt( seed ) % 6 - 3;
 			// ensure the line stays on the screen
-			lx1[i] = min( SCRWIDTH - 1, max( 0, lx1[i] ) );
-			lx2[i] = min( SCRWIDTH - 1, max( 0, lx2[i] ) );
-			ly1[i] = min( SCRHEIGHT - 1, max( 0, ly1[i] ) );
-			ly2[i] = min( SCRHEIGHT - 1, max( 0, ly2[i] ) );
+			l.x1 = min( SCRWIDTH - 1, max( 0, l.x1 ) );
+			l.x2 = min( SCRWIDTH - 1, max( 0, l.x2 ) );
+			l.y1 = min( SCRHEIGHT - 1, max( 0, l.y1 ) );
+			l.y2 = min( SCRHEIGHT - 1, max( 0, l.y2 ) );
 		}
 		else
 		{
 			// new line (25% probability)
-			lx1[i] = RandomUInt() % SCRWIDTH, lx2[i] = RandomUInt() % SCRWIDTH;
-			ly1[i] = RandomUInt() % SCRHEIGHT, ly2[i] = RandomUInt() % SCRHEIGHT;
+#if HOT_SAMPLE
+			if (background) HotPoint( l.x1, l.y1, seed ), HotPoint( l.x2, l.y2, seed ); else
+#endif
+			l.x1 = RandomUInt( seed ) % SCRWIDTH, l.x2 = RandomUInt( seed ) % SCRWIDTH,
+			l.y1 = RandomUInt( seed ) % SCRHEIGHT, l.y2 = RandomUInt( seed ) % SCRHEIGHT;
+		}
+	} while ((abs( l.x1 - l.x2 ) < 3) || (abs( l.y1 - l.y2 ) < 3));
+}
+
+// mutate line i of the genome in place
+Mutation MutateLine( int i, uint& seed, Surface* background = 0 )
+{
+	const Mutation m = { i, GetLine( i ) };
+	Line l = m.before;
+	Mutate( i, l, seed, background );
+	SetLine( i, l );
+	return m;
+}
+
+void UndoMutation( const Mutation& m )
+{
+	// restore the line to the state before the mutation
+	SetLine( m.i, m.before );
+}
+
+// -----------------------------------------------------------
+// Region of interest
+// An optional mask of the pixels that count: MASKFILE if it exists,
+// else the alpha channel of the reference. Pixels with weight 0 are
+// neither scored nor re-rendered; any other weight counts fully.
+// The scored pixels are kept as runs per row for the evaluator, and
+// as a per-pixel mask for the renderer, which also marks the pixels
+// a windowed metric reads around the runs. Without a mask, or with a
+// fully opaque one, the region is inactive.
+// -----------------------------------------------------------
+#define MASKFILE	"assets/mask.png"
+#define ROI_SKIP	0
+#define ROI_DRAW	1											// not scored, but read by the metric window
+#define ROI_SCORE	2
+
+struct RowSpan { int x1, x2; };									// inclusive
+
+// runs of ROI_SCORE pixels in a mask row of n pixels
+void MaskRuns( const BYTE* mask, int n, vector<RowSpan>& runs )
+{
+	runs.clear();
+	for (int x = 0; x < n; x++) if (mask[x] == ROI_SCORE)
+	{
+		const int x1 = x;
+		while (x + 1 < n && mask[x + 1] == ROI_SCORE) x++;
+		runs.push_back( { x1, x } );
+	}
+}
+
+struct RegionOfInterest
+{
+	void Init( const char* referenceFile, int radius )
+	{
+		active = (Load( MASKFILE, false ) || Load( referenceFile, true )) && count( mask.begin(), mask.end(), ROI_SKIP ) > 0;
+		if (!active) { mask.clear(); return; }
+		Build( radius );
+	}
+	// runs, draw margin and bounds of a loaded mask
+	void Build( int radius )
+	{
+		for (int y = 0; y < SCRHEIGHT; y++) MaskRuns( &mask[y * SCRWIDTH], SCRWIDTH, row[y] );
+		// the pixels a window of the given radius reads around the runs
+		for (int y = 0; y < SCRHEIGHT; y++) for (const RowSpan& s : row[y])
+			for (int v = max( 0, y - radius ); v <= min( SCRHEIGHT - 1, y + radius ); v++)
+				for (int u = max( 0, s.x1 - radius ); u <= min( SCRWIDTH - 1, s.x2 + radius ); u++)
+					if (mask[v * SCRWIDTH + u] == ROI_SKIP) mask[v * SCRWIDTH + u] = ROI_DRAW;
+		bounds = { SCRWIDTH, SCRHEIGHT, -1, -1 };
+		for (int y = 0; y < SCRHEIGHT; y++) for (int x = 0; x < SCRWIDTH; x++) if (mask[y * SCRWIDTH + x] != ROI_SKIP)
+			bounds = { min( bounds.x1, x ), min( bounds.y1, y ), max( bounds.x2, x ), max( bounds.y2, y ) };
+	}
+	// weights from the alpha channel, or from the brightest channel of
+	// an image without one (unless alphaOnly)
+	bool Load( const char* file, bool alphaOnly )
+	{
+		int w, h, n;
+		BYTE* data = stbi_load( file, &w, &h, &n, 0 );
+		if (!data) return false;
+		const bool alpha = n == 2 || n == 4;
+		if (alphaOnly && !alpha) { stbi_image_free( data ); return false; }
+		if (w != SCRWIDTH || h != SCRHEIGHT) FatalError( "Mask %s is %ix%i, expected %ix%i", file, w, h, SCRWIDTH, SCRHEIGHT );
+		mask.resize( SCRWIDTH * SCRHEIGHT );
+		for (int i = 0; i < SCRWIDTH * SCRHEIGHT; i++)
+		{
+			const BYTE* p = data + i * n;
+			const BYTE weight = alpha ? p[n - 1] : n == 1 ? p[0] : max( p[0], max( p[1], p[2] ) );
+			mask[i] = weight ? ROI_SCORE : ROI_SKIP;
 		}
-	} while ((abs( lx1[i] - lx2[i] ) < 3) || (abs( ly1[i] - ly2[i] ) < 3));
+		stbi_image_free( data );
+		return true;
+	}
+	// call f( a, b ) for the scored runs of row y within x1..x2
+	template <class F> void Runs( int y, int x1, int x2, F f ) const
+	{
+		if (!active) { f( x1, x2 ); return; }
+		for (const RowSpan& s : row[y]) if (s.x2 >= x1 && s.x1 <= x2) f( max( x1, s.x1 ), min( x2, s.x2 ) );
+	}
+	bool Scores( int x, int y ) const { return !active || mask[y * SCRWIDTH + x] == ROI_SCORE; }
+	bool Draws( int x, int y ) const { return !active || mask[y * SCRWIDTH + x] != ROI_SKIP; }
+	// the part of r anything is read from; empty if x1 > x2
+	Rect Clip( const Rect& r ) const
+	{
+		if (!active) return r;
+		const Rect c = { max( r.x1, bounds.x1 ), max( r.y1, bounds.y1 ), min( r.x2, bounds.x2 ), min( r.y2, bounds.y2 ) };
+		return c.x1 > c.x2 || c.y1 > c.y2 ? Rect{ 0, 0, -1, -1 } : c;
+	}
+	bool Touches( const Rect& r ) const { return Clip( r ).x2 >= 0; }
+	// the span pixels of a line that are scored
+	const vector<uint>& Scored( const vector<uint>& pix ) const
+	{
+		static thread_local vector<uint> scored;
+		scored.clear();
+		for (const uint e : pix) if (Scores( (e >> 9) & 1023, e >> 19 )) scored.push_back( e );
+		return scored;
+	}
+	bool active = false;
+	vector<RowSpan> row[SCRHEIGHT];								// scored runs per row
+	vector<BYTE> mask;											// ROI_SKIP, ROI_DRAW or ROI_SCORE per pixel
+	Rect bounds = {};											// of the pixels that are not ROI_SKIP
+} roi;
+
+// -----------------------------------------------------------
+// Wu blend
+// Mix a line color into a background pixel with weight w (0..255).
+// The weight is flipped when the line is brighter than the background.
+// -----------------------------------------------------------
+inline double GrayDouble( COLORREF c )
+{
+	return GetRValue( c ) * 0.299 + GetGValue( c ) * 0.587 + GetBValue( c ) * 0.114;
+}
+
+inline COLORREF BlendDouble( COLORREF clrBackGround, COLORREF clrLine, double grayl, uint Weighting )
+{
+	const double grayb = GrayDouble( clrBackGround );
+	const double w = (double)(grayl < grayb ? Weighting : (Weighting ^ 255)) / 255.0;
+	BYTE rb = GetRValue( clrBackGround ), rl = GetRValue( clrLine );
+	BYTE gb = GetGValue( clrBackGround ), gl = GetGValue( clrLine );
+	BYTE bb = GetBValue( clrBackGround ), bl = GetBValue( clrLine );
+	BYTE rr = rb > rl ? (BYTE)(w * (rb - rl) + rl) : (BYTE)(w * (rl - rb) + rb);
+	BYTE gr = gb > gl ? (BYTE)(w * (gb - gl) + gl) : (BYTE)(w * (gl - gb) + gb);
+	BYTE br = bb > bl ? (BYTE)(w * (bb - bl) + bl) : (BYTE)(w * (bl - bb) + bb);
+	return RGB( rr, gr, br );
+}
+
+// integer luma, scaled by 1000. Where two of them differ, the double
+// lumas differ by at least 0.001 and order the same way; where they
+// tie, the double lumas may still differ in their rounding, which
+// BlendDouble then follows, so the tie is broken by the doubles.
+inline int GrayFixed( COLORREF c )
+{
+	return GetRValue( c ) * 299 + GetGValue( c ) * 587 + GetBValue( c ) * 114;
+}
+
+// the line is not darker than the background: BlendDouble flips the weight
+inline bool FlipFixed( int grayl, int grayb, COLORREF clrLine, COLORREF clrBackGround )
+{
+	return grayl != grayb ? grayl > grayb : !(GrayDouble( clrLine ) < GrayDouble( clrBackGround ));
 }
 
-void UndoMutation( int i )
+// w * delta is an 8.8 fixed-point product; (x + 1 + (x >> 8)) >> 8 divides
+// it by 255 without a divide. Matches BlendDouble within 1 LSB.
+inline uint LerpFixed( uint b, uint l, uint w )
 {
-	// restore line i to the backuped state
-	lx1[i] = x1_, ly1[i] = y1_;
-	lx2[i] = x2_, ly2[i] = y2_;
-	lc[i] = c_;
+	const uint lo = min( b, l ), x = w * (max( b, l ) - lo);
+	return lo + ((x + 1 + (x >> 8)) >> 8);
 }
 
+inline COLORREF BlendFixed( COLORREF clrBackGround, COLORREF clrLine, int grayl, uint Weighting )
+{
+	const uint w = Weighting ^ (255 & (0 - (uint)FlipFixed( grayl, GrayFixed( clrBackGround ), clrLine, clrBackGround )));
+	const uint rr = LerpFixed( clrBackGround & 255, clrLine & 255, w );
+	const uint gr = LerpFixed( (clrBackGround >> 8) & 255, (clrLine >> 8) & 255, w );
+	const uint br = LerpFixed( (clrBackGround >> 16) & 255, (clrLine >> 16) & 255, w );
+	return rr + (gr << 8) + (br << 16);
+}
+
+// table-driven BlendFixed: the lerp of a channel is one load from a
+// 64KB [weight][delta] table, whose 256-byte row for the current
+// weight serves all three channels; luma is three loads.
+struct BlendTables
+{
+	BlendTables()
+	{
+		for (uint w = 0; w < 256; w++) for (uint d = 0; d < 256; d++) lerp[w][d] = (uchar)LerpFixed( d, 0, w );
+		for (int v = 0; v < 256; v++) luma[0][v] = v * 299, luma[1][v] = v * 587, luma[2][v] = v * 114;
+	}
+	ALIGN( 64 ) uchar lerp[256][256];
+	ALIGN( 64 ) int luma[3][256];
+};
+static const BlendTables lut;
+
+inline uint LerpLUT( const uchar* row, uint b, uint l )
+{
+	return min( b, l ) + row[max( b, l ) - min( b, l )];
+}
+
+inline COLORREF BlendLUT( COLORREF clrBackGround, COLORREF clrLine, int grayl, uint Weighting )
+{
+	const uint rb = clrBackGround & 255, gb = (clrBackGround >> 8) & 255, bb = (clrBackGround >> 16) & 255;
+	const int grayb = lut.luma[0][rb] + lut.luma[1][gb] + lut.luma[2][bb];
+	const uchar* row = lut.lerp[Weighting ^ (255 & (0 - (uint)FlipFixed( grayl, grayb, clrLine, clrBackGround )))];
+	const uint rr = LerpLUT( row, rb, clrLine & 255 );
+	const uint gr = LerpLUT( row, gb, (clrLine >> 8) & 255 );
+	const uint br = LerpLUT( row, bb, (clrLine >> 16) & 255 );
+	return rr + (gr << 8) + (br << 16);
+}
+
+// integer blend used by the fixed-point paths
+#if WU_LUT
+#define BlendInt	BlendLUT
+#else
+#define BlendInt	BlendFixed
+#endif
+
+#if WU_FIXED
+#define WuGray	GrayFixed
+#define WuBlend	BlendInt
+#else
+#define WuGray	GrayDouble
+#define WuBlend	BlendDouble
+#endif
+
 // -----------------------------------------------------------
 // DrawWuLine
 // Anti-aliased line rendering.
@@ -110,10 +373,7 @@ void DrawWuLine( Surface *screen, int X0, int Y0, int X1, int Y1, uint clrLine )
     /* Line is not horizontal, diagonal, or vertical */
     unsigned short ErrorAcc = 0;  /* initialize the line error accumulator to 0 */
 
-    BYTE rl = GetRValue( clrLine );
-    BYTE gl = GetGValue( clrLine );
-    BYTE bl = GetBValue( clrLine );
-    double grayl = rl * 0.299 + gl * 0.587 + bl * 0.114;
+    const auto grayl = WuGray( clrLine );
 
     /* Is this an X-major or Y-major line? */
     if (DeltaY > DeltaX)
@@ -136,27 +396,8 @@ void DrawWuLine( Surface *screen, int X0, int Y0, int X1, int Y1, uint clrLine )
             weighting for the paired pixel */
             Weighting = ErrorAcc >> 8;
 
-            COLORREF clrBackGround = screen->pixels[Y0][X0];
-            BYTE rb = GetRValue( clrBackGround );
-            BYTE gb = GetGValue( clrBackGround );
-            BYTE bb = GetBValue( clrBackGround );
-            double grayb = rb * 0.299 + gb * 0.587 + bb * 0.114;
-
-            BYTE rr = ( rb > rl ? ( ( BYTE )( ( ( double )( grayl<grayb?Weighting:(Weighting ^ 255)) ) / 255.0 * ( rb - rl ) + rl ) ) : ( ( BYTE )( ( ( double )( grayl<grayb?Weighting:(Weighting ^ 255)) ) / 255.0 * ( rl - rb ) + rb ) ) );
-            BYTE gr = ( gb > gl ? ( ( BYTE )( ( ( double )( grayl<grayb?Weighting:(Weighting ^ 255)) ) / 255.0 * ( gb - gl ) + gl ) ) : ( ( BYTE )( ( ( double )( grayl<grayb?Weighting:(Weighting ^ 255)) ) / 255.0 * ( gl - gb ) + gb ) ) );
-            BYTE br = ( bb > bl ? ( ( BYTE )( ( ( double )( grayl<grayb?Weighting:(Weighting ^ 255)) ) / 255.0 * ( bb - bl ) + bl ) ) : ( ( BYTE )( ( ( double )( grayl<grayb?Weighting:(Weighting ^ 255)) ) / 255.0 * ( bl - bb ) + bb ) ) );
-            screen->Plot( X0, Y0, RGB( rr, gr, br ) );
-
-            clrBackGround = screen->pixels[Y0][X0 + XDir];
-            rb = GetRValue( clrBackGround );
-            gb = GetGValue( clrBackGround );
-            bb = GetBValue( clrBackGround );
-            grayb = rb * 0.299 + gb * 0.587 + bb * 0.114;
-
-            rr = ( rb > rl ? ( ( BYTE )( ( ( double )( grayl<grayb?(Weighting ^ 255):Weighting) ) / 255.0 * ( rb - rl ) + rl ) ) : ( ( BYTE )( ( ( double )( grayl<grayb?(Weighting ^ 255):Weighting) ) / 255.0 * ( rl - rb ) + rb ) ) );
-            gr = ( gb > gl ? ( ( BYTE )( ( ( double )( grayl<grayb?(Weighting ^ 255):Weighting) ) / 255.0 * ( gb - gl ) + gl ) ) : ( ( BYTE )( ( ( double )( grayl<grayb?(Weighting ^ 255):Weighting) ) / 255.0 * ( gl - gb ) + gb ) ) );
-            br = ( bb > bl ? ( ( BYTE )( ( ( double )( grayl<grayb?(Weighting ^ 255):Weighting) ) / 255.0 * ( bb - bl ) + bl ) ) : ( ( BYTE )( ( ( double )( grayl<grayb?(Weighting ^ 255):Weighting) ) / 255.0 * ( bl - bb ) + bb ) ) );
-            screen->Plot( X0 + XDir, Y0, RGB( rr, gr, br ) );
+            screen->Plot( X0, Y0, WuBlend( screen->pixels[Y0][X0], clrLine, grayl, Weighting ) );
+            screen->Plot( X0 + XDir, Y0, WuBlend( screen->pixels[Y0][X0 + XDir], clrLine, grayl, Weighting ^ 255 ) );
         }
         /* Draw the final pixel, which is always exactly intersected by the line
         and so needs no weighting */
@@ -181,146 +422,2472 @@ void DrawWuLine( Surface *screen, int X0, int Y0, int X1, int Y1, uint clrLine )
         weighting for the paired pixel */
         Weighting = ErrorAcc >> 8;
 
-        COLORREF clrBackGround = screen->pixels[Y0][X0];
-        BYTE rb = GetRValue( clrBackGround );
-        BYTE gb = GetGValue( clrBackGround );
-        BYTE bb = GetBValue( clrBackGround );
-        double grayb = rb * 0.299 + gb * 0.587 + bb * 0.114;
+        screen->Plot( X0, Y0, WuBlend( screen->pixels[Y0][X0], clrLine, grayl, Weighting ) );
+        screen->Plot( X0, Y0 + 1, WuBlend( screen->pixels[Y0 + 1][X0], clrLine, grayl, Weighting ^ 255 ) );
+    }
+
+    /* Draw the final pixel, which is always exactly intersected by the line
+    and so needs no weighting */
+    screen->Plot( X1, Y1, clrLine );
+}
 
-        BYTE rr = ( rb > rl ? ( ( BYTE )( ( ( double )( grayl<grayb?Weighting:(Weighting ^ 255)) ) / 255.0 * ( rb - rl ) + rl ) ) : ( ( BYTE )( ( ( double )( grayl<grayb?Weighting:(Weighting ^ 255)) ) / 255.0 * ( rl - rb ) + rb ) ) );
-        BYTE gr = ( gb > gl ? ( ( BYTE )( ( ( double )( grayl<grayb?Weighting:(Weighting ^ 255)) ) / 255.0 * ( gb - gl ) + gl ) ) : ( ( BYTE )( ( ( double )( grayl<grayb?Weighting:(Weighting ^ 255)) ) / 255.0 * ( gl - gb ) + gb ) ) );
-        BYTE br = ( bb > bl ? ( ( BYTE )( ( ( double )( grayl<grayb?Weighting:(Weighting ^ 255)) ) / 255.0 * ( bb - bl ) + bl ) ) : ( ( BYTE )( ( ( double )( grayl<grayb?Weighting:(Weighting ^ 255)) ) / 255.0 * ( bl - bb ) + bb ) ) );
+// -----------------------------------------------------------
+// Specialized Wu rasterizers
+// DrawWuLine decides per pixel what is known per line: the major
+// axis, the X step direction and the blend mode. WuOctant is
+// instantiated for each combination, and DrawWuLineT picks the
+// instantiation for a line.
+// Instead of bounds checking every write, the line is clipped once:
+// the pixel positions of step s are a closed-form function of s, so
+// the steps for which the main and the paired pixel are on screen
+// are two ranges. Where both are, the inner loop writes through the
+// row pointers with no checks and no branches; debug builds assert
+// that those writes stay on the surface.
+// -----------------------------------------------------------
+enum { BLEND_DOUBLE = 0, BLEND_FIXED = 1 };
 
-        screen->Plot( X0, Y0, RGB( rr, gr, br ) );
+#define ASSERT_ON_SURFACE( x, y ) assert( (uint)(x) < (uint)screen->width && (uint)(y) < (uint)screen->height )
 
-        clrBackGround = screen->pixels[Y0 + 1][X0];
-        rb = GetRValue( clrBackGround );
-        gb = GetGValue( clrBackGround );
-        bb = GetBValue( clrBackGround );
-        grayb = rb * 0.299 + gb * 0.587 + bb * 0.114;
+// steps s in 1..n-1 for which the pixel (ox, oy) away from the line's
+// pixel at step s is on screen, as the range first..last (may be empty)
+template <bool YMAJOR, int XDIR>
+void ClipSteps( int X0, int Y0, int n, uint ErrorAdj, int ox, int oy, int w, int h, int& first, int& last )
+{
+	const __int64 lo = 1, hi = n - 1;
+	// the major axis moves one pixel per step
+	const __int64 M = YMAJOR ? Y0 + oy : X0 + ox, Mmax = (YMAJOR ? h : w) - 1, dM = YMAJOR ? 1 : XDIR;
+	__int64 s0 = dM > 0 ? -M : M - Mmax, s1 = dM > 0 ? Mmax - M : M;
+	// the minor axis moves c(s) = s * ErrorAdj >> 16 pixels
+	const __int64 m = YMAJOR ? X0 + ox : Y0 + oy, mmax = (YMAJOR ? w : h) - 1, dm = YMAJOR ? XDIR : 1;
+	const __int64 cLo = dm > 0 ? -m : m - mmax, cHi = dm > 0 ? mmax - m : m;
+	if (cLo > 0) s0 = max( s0, (cLo * 65536 + ErrorAdj - 1) / ErrorAdj );
+	s1 = cHi < 0 ? -1 : min( s1, ((cHi + 1) * 65536 - 1) / ErrorAdj );
+	first = (int)max( s0, lo ), last = (int)min( s1, hi );
+}
 
-        rr = ( rb > rl ? ( ( BYTE )( ( ( double )( grayl<grayb?(Weighting ^ 255):Weighting) ) / 255.0 * ( rb - rl ) + rl ) ) : ( ( BYTE )( ( ( double )( grayl<grayb?(Weighting ^ 255):Weighting) ) / 255.0 * ( rl - rb ) + rb ) ) );
-        gr = ( gb > gl ? ( ( BYTE )( ( ( double )( grayl<grayb?(Weighting ^ 255):Weighting) ) / 255.0 * ( gb - gl ) + gl ) ) : ( ( BYTE )( ( ( double )( grayl<grayb?(Weighting ^ 255):Weighting) ) / 255.0 * ( gl - gb ) + gb ) ) );
-        br = ( bb > bl ? ( ( BYTE )( ( ( double )( grayl<grayb?(Weighting ^ 255):Weighting) ) / 255.0 * ( bb - bl ) + bl ) ) : ( ( BYTE )( ( ( double )( grayl<grayb?(Weighting ^ 255):Weighting) ) / 255.0 * ( bl - bb ) + bb ) ) );
+template <bool YMAJOR, int XDIR, int BLEND>
+void WuOctant( Surface* screen, int X0, int Y0, int X1, int Y1, int DeltaMajor, uint ErrorAdj, uint clrLine )
+{
+	const int w = screen->width, h = screen->height;
+	vector<uint>* rows = screen->pixels.data();
+	const int grayi = GrayFixed( clrLine );
+	const double grayd = GrayDouble( clrLine );
+	const int px = YMAJOR ? XDIR : 0, py = YMAJOR ? 0 : 1;	// paired pixel offset
+	if ((uint)X0 < (uint)w && (uint)Y0 < (uint)h) rows[Y0][X0] = clrLine;
+	// clip once: main pixel on screen for steps m0..m1, paired pixel for p0..p1
+	int m0, m1, p0, p1;
+	ClipSteps<YMAJOR, XDIR>( X0, Y0, DeltaMajor, ErrorAdj, 0, 0, w, h, m0, m1 );
+	ClipSteps<YMAJOR, XDIR>( X0, Y0, DeltaMajor, ErrorAdj, px, py, w, h, p0, p1 );
+	const int first = min( m0, p0 ), last = max( m1, p1 ), both0 = max( m0, p0 ), both1 = min( m1, p1 );
+	// jump to the step before the first visible one; ErrorAdj is not
+	// truncated to 16 bits here, so the turnover is simply bit 16 of
+	// the accumulator (a diagonal adds 65536 every step)
+	const unsigned __int64 skipped = (unsigned __int64)(first - 1) * ErrorAdj;
+	uint ErrorAcc = (uint)(skipped & 0xffff);
+	if (YMAJOR) X0 += (int)(skipped >> 16) * XDIR, Y0 += first - 1;
+	else X0 += (first - 1) * XDIR, Y0 += (int)(skipped >> 16);
+	auto advance = [&]()
+	{
+		ErrorAcc += ErrorAdj;
+		const int carry = ErrorAcc >> 16;
+		ErrorAcc &= 0xffff;
+		if (YMAJOR) X0 += carry * XDIR, Y0++; else X0 += XDIR, Y0 += carry;
+	};
+	auto blend = [&]( uint& pixel, uint Weighting )
+	{
+		if (BLEND == BLEND_FIXED) pixel = BlendInt( pixel, clrLine, grayi, Weighting );
+		else pixel = BlendDouble( pixel, clrLine, grayd, Weighting );
+	};
+	int s = first;
+	// head and tail: only one of the two pixels may be on screen
+	auto partial = [&]()
+	{
+		advance();
+		if (s >= m0 && s <= m1) blend( rows[Y0][X0], ErrorAcc >> 8 );
+		if (s >= p0 && s <= p1) blend( rows[Y0 + py][X0 + px], (ErrorAcc >> 8) ^ 255 );
+		s++;
+	};
+	while (s <= last && s < both0) partial();
+	for (; s <= both1; s++)
+	{
+		advance();
+		ASSERT_ON_SURFACE( X0, Y0 );
+		ASSERT_ON_SURFACE( X0 + px, Y0 + py );
+		blend( rows[Y0][X0], ErrorAcc >> 8 );
+		blend( rows[Y0 + py][X0 + px], (ErrorAcc >> 8) ^ 255 );
+	}
+	while (s <= last) partial();
+	if ((uint)X1 < (uint)w && (uint)Y1 < (uint)h) rows[Y1][X1] = clrLine;
+}
 
-        screen->Plot( X0, Y0 + 1, RGB( rr, gr, br ) );
-    }
+typedef void (*WuOctantFunc)( Surface*, int, int, int, int, int, uint, uint );
 
-    /* Draw the final pixel, which is always exactly intersected by the line
-    and so needs no weighting */
-    screen->Plot( X1, Y1, clrLine );
+void DrawWuLineT( Surface* screen, int X0, int Y0, int X1, int Y1, uint clrLine )
+{
+	static const WuOctantFunc octant[8] = {
+		WuOctant<false, -1, BLEND_DOUBLE>, WuOctant<false, -1, BLEND_FIXED>,
+		WuOctant<false, 1, BLEND_DOUBLE>, WuOctant<false, 1, BLEND_FIXED>,
+		WuOctant<true, -1, BLEND_DOUBLE>, WuOctant<true, -1, BLEND_FIXED>,
+		WuOctant<true, 1, BLEND_DOUBLE>, WuOctant<true, 1, BLEND_FIXED>
+	};
+	if (Y0 > Y1) swap( X0, X1 ), swap( Y0, Y1 );
+	const int DeltaX = abs( X1 - X0 ), DeltaY = Y1 - Y0;
+	const bool ymajor = DeltaY > DeltaX;
+	const int DeltaMajor = ymajor ? DeltaY : DeltaX, DeltaMinor = ymajor ? DeltaX : DeltaY;
+	uint ErrorAdj = DeltaMajor ? ((uint)DeltaMinor << 16) / (uint)DeltaMajor : 0;
+	// DrawWuLine's 16-bit accumulator turns over every step when the
+	// adjustment is 0, so axis-aligned lines walk like diagonals
+	if (ErrorAdj == 0) ErrorAdj = 65536;
+	octant[ymajor * 4 + (X1 >= X0) * 2 + WU_FIXED]( screen, X0, Y0, X1, Y1, DeltaMajor, ErrorAdj, clrLine );
 }
 
 // -----------------------------------------------------------
-// Fitness evaluation
-// Compare current generation against reference image.
+// DrawWuLines8
+// Rasterize up to 8 lines in lockstep, one AVX2 lane per line.
+// Every step the lanes advance their DDA together, the pixel
+// pairs are gathered and blended with the integer Wu blend, and
+// the results are written back in line order. Output matches
+// DrawWuLine unless lines in the same batch overlap.
 // -----------------------------------------------------------
-int Game::Evaluate()
+#ifndef USE_ARM
+#ifdef _MSC_VER
+#define AVX2_TARGET
+#define AVX512_TARGET
+#else
+#define AVX2_TARGET __attribute__((target( "avx2" )))
+#define AVX512_TARGET __attribute__((target( "avx512f,avx512bw" )))
+#endif
+#endif
+
+#if WU_BATCH && !defined( USE_ARM )
+
+AVX2_TARGET static inline __m256i LerpFixed8( __m256i b, __m256i l, __m256i w )
 {
-	const uint count = SCRWIDTH * SCRHEIGHT;
-	__int64 diff = 0;
-	for( uint i = 0; i < count; i++ )
+	const __m256i lo = _mm256_min_epu32( b, l );
+	// w * delta fits in 16 bits, so a 16-bit multiply suffices
+	const __m256i x = _mm256_mullo_epi16( w, _mm256_sub_epi32( _mm256_max_epu32( b, l ), lo ) );
+	const __m256i q = _mm256_add_epi32( _mm256_add_epi32( x, _mm256_set1_epi32( 1 ) ), _mm256_srli_epi32( x, 8 ) );
+	return _mm256_add_epi32( lo, _mm256_srli_epi32( q, 8 ) );
+}
+
+AVX2_TARGET static inline __m256i BlendFixed8( __m256i bg, __m256i lineClr, __m256i rl, __m256i gl, __m256i bl, __m256i grayl, __m256i Weighting )
+{
+	const __m256i mask = _mm256_set1_epi32( 255 );
+	const __m256i rb = _mm256_and_si256( bg, mask );
+	const __m256i gb = _mm256_and_si256( _mm256_srli_epi32( bg, 8 ), mask );
+	const __m256i bb = _mm256_and_si256( _mm256_srli_epi32( bg, 16 ), mask );
+	const __m256i grayb = _mm256_add_epi32( _mm256_add_epi32(
+		_mm256_mullo_epi32( rb, _mm256_set1_epi32( 299 ) ),
+		_mm256_mullo_epi32( gb, _mm256_set1_epi32( 587 ) ) ),
+		_mm256_mullo_epi32( bb, _mm256_set1_epi32( 114 ) ) );
+	// grayl < grayb ? Weighting : Weighting ^ 255
+	__m256i w = _mm256_blendv_epi8( _mm256_xor_si256( Weighting, mask ), Weighting, _mm256_cmpgt_epi32( grayb, grayl ) );
+	const int ties = _mm256_movemask_ps( _mm256_castsi256_ps( _mm256_cmpeq_epi32( grayb, grayl ) ) );
+	if (ties)
 	{
-		uint src = screen->pixels[i / SCRWIDTH][i % SCRWIDTH];
-		uint ref = reference->pixels[i / SCRWIDTH][i % SCRWIDTH];
-		int r0 = (src >> 16) & 255, g0 = (src >> 8) & 255, b0 = src & 255;
-		int r1 = ref >> 16, g1 = (ref >> 8) & 255, b1 = ref & 255;
-		int dr = r0 - r1, dg = g0 - g1, db = b0 - b1;
-		// calculate squared color difference;
-		// take into account eye sensitivity to red, green and blue
-		diff += 3 * dr * dr + 6 * dg * dg + db * db;
+		// rare: let the double lumas break the tie, as in FlipFixed
+		ALIGN( 32 ) uint lw[8], lb[8], ll[8], lk[8];
+		_mm256_store_si256( (__m256i*)lw, w ), _mm256_store_si256( (__m256i*)lb, bg );
+		_mm256_store_si256( (__m256i*)ll, lineClr ), _mm256_store_si256( (__m256i*)lk, Weighting );
+		for (int l = 0; l < 8; l++) if (ties & (1 << l))
+			lw[l] = lk[l] ^ (GrayDouble( ll[l] ) < GrayDouble( lb[l] ) ? 0 : 255);
+		w = _mm256_load_si256( (__m256i*)lw );
 	}
-	return (int)(diff >> 5);
+	const __m256i rr = LerpFixed8( rb, rl, w );
+	const __m256i gr = LerpFixed8( gb, gl, w );
+	const __m256i br = LerpFixed8( bb, bl, w );
+	return _mm256_or_si256( rr, _mm256_or_si256( _mm256_slli_epi32( gr, 8 ), _mm256_slli_epi32( br, 16 ) ) );
+}
+
+AVX2_TARGET void DrawWuLines8( Surface* screen, int first, int count )
+{
+	ALIGN( 32 ) int X0[8], Y0[8], X1[8], Y1[8], clr[8], gray[8], steps[8], adj[8];
+	ALIGN( 32 ) int majX[8], majY[8], minX[8], minY[8], pairX[8], pairY[8];
+	int maxSteps = 0;
+	for (int l = 0; l < 8; l++)
+	{
+		if (l >= count)
+		{
+			// idle lane: never becomes active
+			X0[l] = Y0[l] = X1[l] = Y1[l] = clr[l] = gray[l] = steps[l] = adj[l] = 0;
+			majX[l] = majY[l] = minX[l] = minY[l] = pairX[l] = pairY[l] = 0;
+			continue;
+		}
+		const int j = first + l;
+		/* Make sure the line runs top to bottom */
+		if (ly1[j] > ly2[j]) X0[l] = lx2[j], Y0[l] = ly2[j], X1[l] = lx1[j], Y1[l] = ly1[j];
+		else X0[l] = lx1[j], Y0[l] = ly1[j], X1[l] = lx2[j], Y1[l] = ly2[j];
+		clr[l] = lc[j], gray[l] = GrayFixed( lc[j] );
+		const int XDir = X1[l] >= X0[l] ? 1 : -1;
+		const int DeltaX = abs( X1[l] - X0[l] ), DeltaY = Y1[l] - Y0[l];
+		if (DeltaY > DeltaX)
+		{
+			// Y-major: always advance Y, advance X on turnover, pair to the side
+			adj[l] = (int)(((unsigned long)DeltaX << 16) / (unsigned long)DeltaY) & 0xffff;
+			majX[l] = 0, majY[l] = 1, minX[l] = XDir, minY[l] = 0, pairX[l] = XDir, pairY[l] = 0;
+			steps[l] = DeltaY - 1;
+		}
+		else
+		{
+			// X-major: always advance X, advance Y on turnover, pair below
+			adj[l] = DeltaX ? (int)(((unsigned long)DeltaY << 16) / (unsigned long)DeltaX) & 0xffff : 0;
+			majX[l] = XDir, majY[l] = 0, minX[l] = 0, minY[l] = 1, pairX[l] = 0, pairY[l] = 1;
+			steps[l] = DeltaX - 1;
+		}
+		steps[l] = max( 0, steps[l] );
+		maxSteps = max( maxSteps, steps[l] );
+		/* Draw the initial pixel */
+		screen->Plot( X0[l], Y0[l], clr[l] );
+	}
+	const __m256i mask = _mm256_set1_epi32( 255 );
+	const __m256i lineClr = _mm256_load_si256( (__m256i*)clr );
+	const __m256i rl = _mm256_and_si256( lineClr, mask );
+	const __m256i gl = _mm256_and_si256( _mm256_srli_epi32( lineClr, 8 ), mask );
+	const __m256i bl = _mm256_and_si256( _mm256_srli_epi32( lineClr, 16 ), mask );
+	const __m256i grayl = _mm256_load_si256( (__m256i*)gray );
+	const __m256i vsteps = _mm256_load_si256( (__m256i*)steps );
+	const __m256i vadj = _mm256_load_si256( (__m256i*)adj );
+	const __m256i vmajX = _mm256_load_si256( (__m256i*)majX ), vmajY = _mm256_load_si256( (__m256i*)majY );
+	const __m256i vminX = _mm256_load_si256( (__m256i*)minX ), vminY = _mm256_load_si256( (__m256i*)minY );
+	const __m256i vpairX = _mm256_load_si256( (__m256i*)pairX ), vpairY = _mm256_load_si256( (__m256i*)pairY );
+	__m256i x = _mm256_load_si256( (__m256i*)X0 ), y = _mm256_load_si256( (__m256i*)Y0 );
+	__m256i acc = _mm256_setzero_si256();
+	ALIGN( 32 ) int px[8], py[8], qx[8], qy[8], active[8];
+	ALIGN( 32 ) uint bg0[8], bg1[8], out0[8], out1[8];
+	const int w = screen->width, h = screen->height;
+	for (int s = 0; s < maxSteps; s++)
+	{
+		/* Advance the error accumulators; a 16-bit turnover moves the minor axis */
+		const __m256i next = _mm256_and_si256( _mm256_add_epi32( acc, vadj ), _mm256_set1_epi32( 0xffff ) );
+		const __m256i carry = _mm256_xor_si256( _mm256_cmpgt_epi32( next, acc ), _mm256_set1_epi32( -1 ) );
+		acc = next;
+		x = _mm256_add_epi32( x, _mm256_add_epi32( vmajX, _mm256_and_si256( carry, vminX ) ) );
+		y = _mm256_add_epi32( y, _mm256_add_epi32( vmajY, _mm256_and_si256( carry, vminY ) ) );
+		const __m256i Weighting = _mm256_srli_epi32( acc, 8 );
+		_mm256_store_si256( (__m256i*)px, x );
+		_mm256_store_si256( (__m256i*)py, y );
+		_mm256_store_si256( (__m256i*)qx, _mm256_add_epi32( x, vpairX ) );
+		_mm256_store_si256( (__m256i*)qy, _mm256_add_epi32( y, vpairY ) );
+		_mm256_store_si256( (__m256i*)active, _mm256_cmpgt_epi32( vsteps, _mm256_set1_epi32( s ) ) );
+		/* Gather the pixel pairs */
+		for (int l = 0; l < 8; l++)
+		{
+			bg0[l] = active[l] && (uint)px[l] < (uint)w && (uint)py[l] < (uint)h ? screen->pixels[py[l]][px[l]] : 0;
+			bg1[l] = active[l] && (uint)qx[l] < (uint)w && (uint)qy[l] < (uint)h ? screen->pixels[qy[l]][qx[l]] : 0;
+		}
+		const __m256i c0 = BlendFixed8( _mm256_load_si256( (__m256i*)bg0 ), lineClr, rl, gl, bl, grayl, Weighting );
+		const __m256i c1 = BlendFixed8( _mm256_load_si256( (__m256i*)bg1 ), lineClr, rl, gl, bl, grayl, _mm256_xor_si256( Weighting, mask ) );
+		_mm256_store_si256( (__m256i*)out0, c0 );
+		_mm256_store_si256( (__m256i*)out1, c1 );
+		/* Scatter in line order */
+		for (int l = 0; l < 8; l++) if (active[l])
+		{
+			screen->Plot( px[l], py[l], out0[l] );
+			screen->Plot( qx[l], qy[l], out1[l] );
+		}
+	}
+	/* Draw the final pixels */
+	for (int l = 0; l < count; l++) screen->Plot( X1[l], Y1[l], clr[l] );
 }
 
+#endif
+
 // -----------------------------------------------------------
-// Application initialization
-// Load a previously saved generation, if available.
+// Line coverage cache
+// The pixels a Wu line touches and their weights depend only on
+// its endpoints, so they are recorded once per line and replayed
+// as a flat span list. A color mutation keeps the span; moving an
+// endpoint rebuilds it on the next draw.
 // -----------------------------------------------------------
-void Game::Init()
+#define SPAN_SOLID	256											// span weight for unblended end pixels
+
+struct LineSpan
 {
-	for (int i = 0; i < LINES; i++) MutateLine( i );
-	FILE* f = fopen( LINEFILE, "rb" );
-	if (f)
+	int x1 = -1, y1 = -1, x2 = -1, y2 = -1;						// endpoints the span was built for
+	vector<uint> pix;											// (y << 10 | x) << 9 | weight
+};
+LineSpan span[LINES];
+
+inline void AddSpanPixel( LineSpan& s, int x, int y, uint weight )
+{
+	// Plot skips off-screen pixels, so the span does too
+	if (x < 0 || y < 0 || x >= SCRWIDTH || y >= SCRHEIGHT) return;
+	s.pix.push_back( (((uint)y << 10) | (uint)x) << 9 | weight );
+}
+
+// same walk as DrawWuLine, recording pixels instead of blending them
+void BuildSpan( LineSpan& s, int X0, int Y0, int X1, int Y1 )
+{
+	s.x1 = X0, s.y1 = Y0, s.x2 = X1, s.y2 = Y1;
+	s.pix.clear();
+	if (Y0 > Y1) swap( X0, X1 ), swap( Y0, Y1 );
+	AddSpanPixel( s, X0, Y0, SPAN_SOLID );
+	int XDir = 1, DeltaX = X1 - X0, DeltaY = Y1 - Y0;
+	if (DeltaX < 0) XDir = -1, DeltaX = -DeltaX;
+	if (DeltaX == 0 && DeltaY == 0) return;					// a single pixel; no step to divide by
+	unsigned short ErrorAdj, ErrorAccTemp, ErrorAcc = 0;
+	if (DeltaY > DeltaX)
 	{
-		fread( lx1, 4, LINES, f );
-		fread( ly1, 4, LINES, f );
-		fread( lx2, 4, LINES, f );
-		fread( ly2, 4, LINES, f );
-		fread( lc, 4, LINES, f );
-		fclose( f );
+		ErrorAdj = ((unsigned long)DeltaX << 16) / (unsigned long)DeltaY;
+		while (--DeltaY)
+		{
+			ErrorAccTemp = ErrorAcc;
+			ErrorAcc += ErrorAdj;
+			if (ErrorAcc <= ErrorAccTemp) X0 += XDir;
+			Y0++;
+			AddSpanPixel( s, X0, Y0, ErrorAcc >> 8 );
+			AddSpanPixel( s, X0 + XDir, Y0, (ErrorAcc >> 8) ^ 255 );
+		}
 	}
-	reference = new Surface( "assets/bird.png" );
-	backup = new Surface( SCRWIDTH, SCRHEIGHT );
+	else
+	{
+		ErrorAdj = ((unsigned long)DeltaY << 16) / (unsigned long)DeltaX;
+		while (--DeltaX)
+		{
+			ErrorAccTemp = ErrorAcc;
+			ErrorAcc += ErrorAdj;
+			if (ErrorAcc <= ErrorAccTemp) Y0++;
+			X0 += XDir;
+			AddSpanPixel( s, X0, Y0, ErrorAcc >> 8 );
+			AddSpanPixel( s, X0, Y0 + 1, (ErrorAcc >> 8) ^ 255 );
+		}
+	}
+	AddSpanPixel( s, X1, Y1, SPAN_SOLID );
+}
 
-	for (int y = 0; y < SCRHEIGHT; y++)
-		for (int x = 0; x < SCRWIDTH; x++)
-			screen->pixels[y][x] = 0xFFFFFFFF;
+const LineSpan& GetSpan( int i )
+{
+	LineSpan& s = span[i];
+	if (s.x1 != lx1[i] || s.y1 != ly1[i] || s.x2 != lx2[i] || s.y2 != ly2[i])
+		BuildSpan( s, lx1[i], ly1[i], lx2[i], ly2[i] );
+	return s;
+}
+
+// weighted squared color difference of one pixel, as in Evaluate
+inline int PixelError( uint src, uint ref )
+{
+	const int dr = (int)((src >> 16) & 255) - (int)((ref >> 16) & 255);
+	const int dg = (int)((src >> 8) & 255) - (int)((ref >> 8) & 255);
+	const int db = (int)(src & 255) - (int)(ref & 255);
+	return 3 * dr * dr + 6 * dg * dg + db * db;
+}
 
-	for (int j = 0; j < LINES; j++)
+// blend span entries first..last-1 of line i
+void BlendRun( Surface* screen, int i, int first, int last )
+{
+	const uint* p = span[i].pix.data();
+	const uint clrLine = lc[i];
+	const auto grayl = WuGray( clrLine );
+	vector<uint>* rows = screen->pixels.data();
+	for (int k = first; k < last; k++)
 	{
-		DrawWuLine( screen, lx1[j], ly1[j], lx2[j], ly2[j], lc[j] );
+		const uint e = p[k], weight = e & 511;
+		uint& pixel = rows[e >> 19][(e >> 9) & 1023];
+		pixel = weight == SPAN_SOLID ? clrLine : WuBlend( pixel, clrLine, grayl, weight );
 	}
-	fitness = Evaluate();
+}
+
+// replay a cached span; identical output to DrawWuLine
+void DrawSpan( Surface* screen, int i )
+{
+	BlendRun( screen, i, 0, (int)GetSpan( i ).pix.size() );
+}
+
+// same, but only the pixels inside r; with STEP (a power of 2), only
+// every STEP-th row of r
+template <int STEP = 1> void DrawSpanClipped( Surface* screen, const LineSpan& s, uint clrLine, const Rect& r )
+{
+	const auto grayl = WuGray( clrLine );
+	for (const uint e : s.pix)
+	{
+		const int x = (e >> 9) & 1023, y = e >> 19;
+		if (x < r.x1 || x > r.x2 || y < r.y1 || y > r.y2) continue;
+		if (STEP > 1 && ((y - r.y1) & (STEP - 1))) continue;
+#if ROI_MASK
+		if (!roi.Draws( x, y )) continue;
+#endif
+		const uint weight = e & 511;
+		uint& pixel = screen->pixels[y][x];
+		pixel = weight == SPAN_SOLID ? clrLine : WuBlend( pixel, clrLine, grayl, weight );
+	}
+}
+
+template <int STEP = 1> void DrawSpanClipped( Surface* screen, int i, const Rect& r )
+{
+	DrawSpanClipped<STEP>( screen, GetSpan( i ), lc[i], r );
 }
 
 // -----------------------------------------------------------
-// Main application tick function
+// Vectorized error kernels
+// Weighted squared error of a run of n pixels, 8 (AVX2) or 16
+// (AVX-512) pixels per step. Absolute channel differences are
+// taken on the packed bytes, widened to 16 bits and squared with
+// a multiply-add against the per-channel weights (b,g,r,a =
+// 1,6,3,0), so canvas and reference stay in their native layout.
+// 32-bit lane sums are widened to 64 bits every BLOCK pixels.
 // -----------------------------------------------------------
-void Game::Tick( float /* deltaTime */ )
+#if SIMD_EVAL && !defined( USE_ARM )
+
+// weighted squares of the channel differences; lo holds b+g and r+a
+// of pixels 0,1,4,5, hi those of pixels 2,3,6,7
+AVX2_TARGET static inline void ChannelSquares8( __m256i s, __m256i r, __m256i w, __m256i& lo, __m256i& hi )
 {
-	timer.reset();
-	int lineCount = 0;
-	int iterCount = 0;
+	const __m256i d = _mm256_or_si256( _mm256_subs_epu8( s, r ), _mm256_subs_epu8( r, s ) );
+	lo = _mm256_unpacklo_epi8( d, _mm256_setzero_si256() );
+	hi = _mm256_unpackhi_epi8( d, _mm256_setzero_si256() );
+	lo = _mm256_madd_epi16( lo, _mm256_mullo_epi16( lo, w ) );
+	hi = _mm256_madd_epi16( hi, _mm256_mullo_epi16( hi, w ) );
+}
 
-	// draw up to lidx
-	for (int y = 0; y < SCRHEIGHT; y++)
-		for (int x = 0; x < SCRWIDTH; x++)
-			screen->pixels[y][x] = 0xFFFFFFFF;
+AVX2_TARGET static inline __m256i AbsDiffSquared8( __m256i s, __m256i r, __m256i w )
+{
+	__m256i lo, hi;
+	ChannelSquares8( s, r, w, lo, hi );
+	return _mm256_add_epi32( lo, hi );
+}
 
-	for (int j = 0; j < lidx; j++, lineCount++)
+// the error of each of the 8 pixels, in pixel order
+AVX2_TARGET static inline __m256i PixelError8( __m256i s, __m256i r, __m256i w )
+{
+	__m256i lo, hi;
+	ChannelSquares8( s, r, w, lo, hi );
+	return _mm256_hadd_epi32( lo, hi );
+}
+
+AVX2_TARGET static __int64 RowError8( const uint* src, const uint* ref, int n )
+{
+	// a step adds at most 2 * 7 * 255^2 to a lane
+	const int BLOCK = 2048;
+	const __m256i w = _mm256_setr_epi16( 1, 6, 3, 0, 1, 6, 3, 0, 1, 6, 3, 0, 1, 6, 3, 0 );
+	__int64 diff = 0;
+	int x = 0;
+	for (const int end8 = n & ~7; x < end8;)
 	{
-		DrawWuLine( screen, lx1[j], ly1[j], lx2[j], ly2[j], lc[j] );
+		__m256i acc = _mm256_setzero_si256();
+		for (const int end = min( end8, x + BLOCK ); x < end; x += 8)
+			acc = _mm256_add_epi32( acc, AbsDiffSquared8( _mm256_loadu_si256( (const __m256i*)(src + x) ),
+				_mm256_loadu_si256( (const __m256i*)(ref + x) ), w ) );
+		const __m256i wide = _mm256_add_epi64( _mm256_cvtepu32_epi64( _mm256_castsi256_si128( acc ) ),
+			_mm256_cvtepu32_epi64( _mm256_extracti128_si256( acc, 1 ) ) );
+		ALIGN( 32 ) __int64 part[4];
+		_mm256_store_si256( (__m256i*)part, wide );
+		diff += part[0] + part[1] + part[2] + part[3];
 	}
-	int base = lidx;
-	screen->CopyTo( backup, 0, 0 );
-	// iterate and draw from lidx to end
-	for (int k = 0; k < ITERATIONS; k++)
+	for (; x < n; x++) diff += PixelError( src[x], ref[x] );
+	return diff;
+}
+
+AVX512_TARGET static inline __m512i AbsDiffSquared16( __m512i s, __m512i r, __m512i w )
+{
+	const __m512i d = _mm512_or_si512( _mm512_subs_epu8( s, r ), _mm512_subs_epu8( r, s ) );
+	const __m512i lo = _mm512_unpacklo_epi8( d, _mm512_setzero_si512() );
+	const __m512i hi = _mm512_unpackhi_epi8( d, _mm512_setzero_si512() );
+	return _mm512_add_epi32( _mm512_madd_epi16( lo, _mm512_mullo_epi16( lo, w ) ),
+		_mm512_madd_epi16( hi, _mm512_mullo_epi16( hi, w ) ) );
+}
+
+AVX512_TARGET static __int64 RowError16( const uint* src, const uint* ref, int n )
+{
+	const int BLOCK = 2048;
+	const __m512i w = _mm512_set1_epi64( 0x0000000300060001ll ); // 1, 6, 3, 0 per pixel
+	__int64 diff = 0;
+	int x = 0;
+	for (const int end16 = n & ~15; x < end16;)
 	{
-		backup->CopyTo( screen, 0, 0 );
-		MutateLine( lidx );
-		for (int j = base; j < LINES; j++, lineCount++)
+		__m512i acc = _mm512_setzero_si512();
+		for (const int end = min( end16, x + BLOCK ); x < end; x += 16)
+			acc = _mm512_add_epi32( acc, AbsDiffSquared16( _mm512_loadu_si512( src + x ), _mm512_loadu_si512( ref + x ), w ) );
+		const __m512i wide = _mm512_add_epi64( _mm512_cvtepu32_epi64( _mm512_castsi512_si256( acc ) ),
+			_mm512_cvtepu32_epi64( _mm512_extracti64x4_epi64( acc, 1 ) ) );
+		ALIGN( 64 ) __int64 part[8];
+		_mm512_store_si512( part, wide );
+		for (int k = 0; k < 8; k++) diff += part[k];
+	}
+	for (; x < n; x++) diff += PixelError( src[x], ref[x] );
+	return diff;
+}
+
+AVX2_TARGET static __int64 RowErrorDelta8( const uint* src, const uint* ref, const int* err, int* out, int n )
+{
+	// a step adds at most 10 * 255^2 to a lane
+	const int BLOCK = 2048;
+	const __m256i w = _mm256_setr_epi16( 1, 6, 3, 0, 1, 6, 3, 0, 1, 6, 3, 0, 1, 6, 3, 0 );
+	__int64 delta = 0;
+	int x = 0;
+	for (const int end8 = n & ~7; x < end8;)
+	{
+		__m256i acc = _mm256_setzero_si256();
+		for (const int end = min( end8, x + BLOCK ); x < end; x += 8)
 		{
-			DrawWuLine( screen, lx1[j], ly1[j], lx2[j], ly2[j], lc[j] );
+			const __m256i e = PixelError8( _mm256_loadu_si256( (const __m256i*)(src + x) ),
+				_mm256_loadu_si256( (const __m256i*)(ref + x) ), w );
+			_mm256_storeu_si256( (__m256i*)(out + x), e );
+			acc = _mm256_add_epi32( acc, _mm256_sub_epi32( e, _mm256_loadu_si256( (const __m256i*)(err + x) ) ) );
 		}
-		int diff = Evaluate();
-		if (diff < fitness) fitness = diff; else UndoMutation( lidx );
-		lidx = (lidx + 1) % LINES;
-		iterCount++;
+		const __m256i wide = _mm256_add_epi64( _mm256_cvtepi32_epi64( _mm256_castsi256_si128( acc ) ),
+			_mm256_cvtepi32_epi64( _mm256_extracti128_si256( acc, 1 ) ) );
+		ALIGN( 32 ) __int64 part[4];
+		_mm256_store_si256( (__m256i*)part, wide );
+		delta += part[0] + part[1] + part[2] + part[3];
 	}
+	for (; x < n; x++) delta += (out[x] = PixelError( src[x], ref[x] )) - err[x];
+	return delta;
+}
 
-	// stats
-	char t[128];
-	float elapsed = timer.elapsed();
-	float lps = (float)lineCount / elapsed;
-	peak = max( lps, peak );
-	sprintf( t, "fitness: %i", fitness );
-	screen->Bar( 0, SCRHEIGHT - 33, 130, SCRHEIGHT - 1, 0 );
-	screen->Print( t, 2, SCRHEIGHT - 24, 0xffffff );
-	sprintf( t, "lps:     %5.2fK", lps );
-	screen->Print( t, 2, SCRHEIGHT - 16, 0xffffff );
-	sprintf( t, "ips:     %5.2f", (iterCount * 1000) / elapsed );
-	screen->Print( t, 2, SCRHEIGHT - 8, 0xffffff );
-	sprintf( t, "peak:    %5.2f", peak );
-	screen->Print( t, 2, SCRHEIGHT - 32, 0xffffff );
+#endif
+
+// weighted squared error of n pixels, unscaled
+__int64 RowError( const uint* src, const uint* ref, int n )
+{
+#if SIMD_EVAL && !defined( USE_ARM )
+	if (CPUCaps::HW_AVX512BW) return RowError16( src, ref, n );
+	if (CPUCaps::HW_AVX2) return RowError8( src, ref, n );
+#endif
+	__int64 diff = 0;
+	for (int x = 0; x < n; x++) diff += PixelError( src[x], ref[x] );
+	return diff;
+}
+
+// per-pixel errors of n pixels into out; returns the change in total
+// error relative to the errors in err
+__int64 RowErrorDelta( const uint* src, const uint* ref, const int* err, int* out, int n )
+{
+#if SIMD_EVAL && !defined( USE_ARM )
+	if (CPUCaps::HW_AVX2) return RowErrorDelta8( src, ref, err, out, n );
+#endif
+	__int64 delta = 0;
+	for (int x = 0; x < n; x++) delta += (out[x] = PixelError( src[x], ref[x] )) - err[x];
+	return delta;
+}
+
+// -----------------------------------------------------------
+// Fitness metrics
+// The error the optimizer minimizes, per pixel. ScoreRow fills the
+// per-pixel errors of a row segment and returns the change against
+// the previous errors, which is what the error buffer needs to score
+// a dirty rectangle. A metric whose pixel error depends on
+// neighbours reports how far a change spreads (Radius), and gets to
+// Prepare the region before its rows are scored.
+// - RGB: the 3/6/1 weighted squared difference.
+// - Lab: squared CIE76 delta E * 16, through lookup tables.
+// - SSIM: (1 - luma SSIM over a 7x7 window) * 65536, with window
+//   sums from integral images.
+// -----------------------------------------------------------
+class Metric
+{
+public:
+	virtual ~Metric() = default;
+	virtual void Init() {}
+	virtual int Radius() { return 0; }
+	virtual void Prepare( Surface* /* screen */, const Rect& /* r */ ) {}
+	virtual __int64 ScoreRow( Surface* screen, int y, int x1, int n, const int* err, int* out ) = 0;
+	// same, for the pixels in the region of interest; the others get 0
+	__int64 ScoreRuns( Surface* screen, int y, int x1, int n, const int* err, int* out )
+	{
+		if (!ROI_MASK || !roi.active) return ScoreRow( screen, y, x1, n, err, out );
+		fill( out, out + n, 0 );
+		__int64 delta = 0;
+		roi.Runs( y, x1, x1 + n - 1, [&]( int a, int b ) { delta += ScoreRow( screen, y, a, b - a + 1, err + a - x1, out + a - x1 ); } );
+		return delta;
+	}
+	// total error of full rows y1..y2, per row into rows[y - y1]
+	virtual __int64 RowsError( Surface* screen, int y1, int y2, __int64* rows )
+	{
+		static thread_local vector<int> zero( SCRWIDTH ), out( SCRWIDTH );
+		Prepare( screen, { 0, y1, SCRWIDTH - 1, y2 } );
+		__int64 diff = 0;
+		for (int y = y1; y <= y2; y++) diff += rows[y - y1] = ScoreRuns( screen, y, 0, SCRWIDTH, zero.data(), out.data() );
+		return diff;
+	}
+};
+
+class RGBMetric : public Metric
+{
+public:
+	__int64 ScoreRow( Surface* screen, int y, int x1, int n, const int* err, int* out )
+	{
+		return RowErrorDelta( screen->pixels[y].data() + x1, reference->pixels[y].data() + x1, err, out, n );
+	}
+	__int64 RowsError( Surface* screen, int y1, int y2, __int64* rows )
+	{
+		if (ROI_MASK && roi.active) return Metric::RowsError( screen, y1, y2, rows );
+		__int64 diff = 0;
+		for (int y = y1; y <= y2; y++)
+			diff += rows[y - y1] = RowError( screen->pixels[y].data(), reference->pixels[y].data(), SCRWIDTH );
+		return diff;
+	}
+};
+
+// sRGB (D65) to CIE-Lab: decoding and the cube root go through tables,
+// the reference is converted once into planar L, a and b
+#define LAB_STEPS	16384										// resolution of the cube root table
+
+class LabMetric : public Metric
+{
+public:
+	void Init()
+	{
+		for (int i = 0; i < 256; i++)
+		{
+			const double c = i / 255.0;
+			linear[i] = (float)(c <= 0.04045 ? c / 12.92 : pow( (c + 0.055) / 1.055, 2.4 ));
+		}
+		for (int i = 0; i <= LAB_STEPS; i++)
+		{
+			const double t = (double)i / LAB_STEPS;
+			cubeRoot[i] = (float)(t > 216.0 / 24389 ? cbrt( t ) : (24389.0 / 27 * t + 16) / 116);
+		}
+		refL.resize( SCRWIDTH * SCRHEIGHT ), refA.resize( SCRWIDTH * SCRHEIGHT ), refB.resize( SCRWIDTH * SCRHEIGHT );
+		for (int y = 0; y < SCRHEIGHT; y++) for (int x = 0; x < SCRWIDTH; x++)
+		{
+			const int i = y * SCRWIDTH + x;
+			ToLab( reference->pixels[y][x], refL[i], refA[i], refB[i] );
+		}
+	}
+	void ToLab( uint p, float& L, float& a, float& b )
+	{
+		const float r = linear[(p >> 16) & 255], g = linear[(p >> 8) & 255], bl = linear[p & 255];
+		const float fx = F( M[0] * r + M[1] * g + M[2] * bl );
+		const float fy = F( M[3] * r + M[4] * g + M[5] * bl );
+		const float fz = F( M[6] * r + M[7] * g + M[8] * bl );
+		L = 116 * fy - 16, a = 500 * (fx - fy), b = 200 * (fy - fz);
+	}
+	float F( float t ) { return cubeRoot[(int)(min( 1.0f, max( 0.0f, t ) ) * LAB_STEPS)]; }
+	__int64 ScoreRow( Surface* screen, int y, int x1, int n, const int* err, int* out );
+	float linear[256], cubeRoot[LAB_STEPS + 1];
+	vector<float> refL, refA, refB;								// planar reference
+	// linear sRGB to XYZ, rows divided by the D65 white point
+	const float M[9] = {
+		0.4124564f / 0.95047f, 0.3575761f / 0.95047f, 0.1804375f / 0.95047f,
+		0.2126729f, 0.7151522f, 0.0721750f,
+		0.0193339f / 1.08883f, 0.1191920f / 1.08883f, 0.9503041f / 1.08883f };
+};
+
+#if SIMD_EVAL && !defined( USE_ARM )
+// cube root table lookup of the clamped XYZ component M . (r, g, b)
+AVX2_TARGET static inline __m256 LabF8( const LabMetric& m, const float* M, __m256 r, __m256 g, __m256 b )
+{
+	const __m256 t = _mm256_add_ps( _mm256_add_ps( _mm256_mul_ps( _mm256_set1_ps( M[0] ), r ), _mm256_mul_ps( _mm256_set1_ps( M[1] ), g ) ),
+		_mm256_mul_ps( _mm256_set1_ps( M[2] ), b ) );
+	const __m256 c = _mm256_min_ps( _mm256_set1_ps( 1 ), _mm256_max_ps( _mm256_setzero_ps(), t ) );
+	return _mm256_i32gather_ps( m.cubeRoot, _mm256_cvttps_epi32( _mm256_mul_ps( c, _mm256_set1_ps( LAB_STEPS ) ) ), 4 );
+}
+
+AVX2_TARGET static __int64 LabRowDelta8( const LabMetric& m, const uint* src, const float* L, const float* A, const float* B,
+	const int* err, int* out, int n )
+{
+	const __m256i mask = _mm256_set1_epi32( 255 );
+	__int64 delta = 0;
+	int x = 0;
+	for (; x + 8 <= n; x += 8)
+	{
+		const __m256i p = _mm256_loadu_si256( (const __m256i*)(src + x) );
+		const __m256 r = _mm256_i32gather_ps( m.linear, _mm256_and_si256( _mm256_srli_epi32( p, 16 ), mask ), 4 );
+		const __m256 g = _mm256_i32gather_ps( m.linear, _mm256_and_si256( _mm256_srli_epi32( p, 8 ), mask ), 4 );
+		const __m256 b = _mm256_i32gather_ps( m.linear, _mm256_and_si256( p, mask ), 4 );
+		const __m256 fx = LabF8( m, m.M, r, g, b ), fy = LabF8( m, m.M + 3, r, g, b ), fz = LabF8( m, m.M + 6, r, g, b );
+		const __m256 dL = _mm256_sub_ps( _mm256_sub_ps( _mm256_mul_ps( _mm256_set1_ps( 116 ), fy ), _mm256_set1_ps( 16 ) ), _mm256_loadu_ps( L + x ) );
+		const __m256 dA = _mm256_sub_ps( _mm256_mul_ps( _mm256_set1_ps( 500 ), _mm256_sub_ps( fx, fy ) ), _mm256_loadu_ps( A + x ) );
+		const __m256 dB = _mm256_sub_ps( _mm256_mul_ps( _mm256_set1_ps( 200 ), _mm256_sub_ps( fy, fz ) ), _mm256_loadu_ps( B + x ) );
+		const __m256 d2 = _mm256_add_ps( _mm256_add_ps( _mm256_mul_ps( dL, dL ), _mm256_mul_ps( dA, dA ) ), _mm256_mul_ps( dB, dB ) );
+		const __m256i e = _mm256_cvttps_epi32( _mm256_mul_ps( d2, _mm256_set1_ps( 16 ) ) );
+		_mm256_storeu_si256( (__m256i*)(out + x), e );
+		const __m256i d = _mm256_sub_epi32( e, _mm256_loadu_si256( (const __m256i*)(err + x) ) );
+		ALIGN( 32 ) int part[8];
+		_mm256_store_si256( (__m256i*)part, d );
+		for (int k = 0; k < 8; k++) delta += part[k];
+	}
+	return delta;
+}
+#endif
+
+__int64 LabMetric::ScoreRow( Surface* screen, int y, int x1, int n, const int* err, int* out )
+{
+	const uint* src = screen->pixels[y].data() + x1;
+	const int o = y * SCRWIDTH + x1;
+	__int64 delta = 0;
+	int x = 0;
+#if SIMD_EVAL && !defined( USE_ARM )
+	if (CPUCaps::HW_AVX2) delta = LabRowDelta8( *this, src, &refL[o], &refA[o], &refB[o], err, out, n ), x = n & ~7;
+#endif
+	for (; x < n; x++)
+	{
+		float L, a, b;
+		ToLab( src[x], L, a, b );
+		const float dL = L - refL[o + x], dA = a - refA[o + x], dB = b - refB[o + x];
+		out[x] = (int)((dL * dL + dA * dA + dB * dB) * 16);
+		delta += out[x] - err[x];
+	}
+	return delta;
+}
+
+// luma SSIM; window sums are exact in 32 bits (49 * 255^2 < 2^32),
+// so the integral images may wrap around. Sums of the reference
+// windows are computed once.
+#define SSIM_RADIUS	3
+
+class SSIMMetric : public Metric
+{
+public:
+	void Init()
+	{
+		refLuma.resize( SCRWIDTH * SCRHEIGHT );
+		for (int y = 0; y < SCRHEIGHT; y++) for (int x = 0; x < SCRWIDTH; x++)
+			refLuma[y * SCRWIDTH + x] = Luma( reference->pixels[y][x] );
+		// window sums of the reference, from its own integral images
+		refSum.resize( SCRWIDTH * SCRHEIGHT ), refSq.resize( SCRWIDTH * SCRHEIGHT );
+		Integrate( reference, { 0, 0, SCRWIDTH - 1, SCRHEIGHT - 1 } );
+		const Sums& s = Work();
+		for (int y = 0; y < SCRHEIGHT; y++) for (int x = 0; x < SCRWIDTH; x++)
+		{
+			const int i = y * SCRWIDTH + x;
+			refSum[i] = (int)Window( s, s.x, x, y ), refSq[i] = (int)Window( s, s.xx, x, y );
+		}
+	}
+	static int Luma( uint p ) { return (int)((((p >> 16) & 255) * 77 + ((p >> 8) & 255) * 150 + (p & 255) * 29) >> 8); }
+	int Radius() { return SSIM_RADIUS; }
+	// integral images of screen luma x over r grown by the window radius:
+	// sums of x, x^2 and x * reference luma. Each thread has its own.
+	struct Sums
+	{
+		vector<uint> x, xx, xy;
+		Rect g = {};											// covered pixels
+		int pitch = 0;
+	};
+	static Sums& Work() { static thread_local Sums sums; return sums; }
+	void Integrate( Surface* screen, const Rect& r )
+	{
+		Sums& s = Work();
+		Rect& g = s.g;
+		g = { max( 0, r.x1 - SSIM_RADIUS ), max( 0, r.y1 - SSIM_RADIUS ),
+			min( SCRWIDTH - 1, r.x2 + SSIM_RADIUS ), min( SCRHEIGHT - 1, r.y2 + SSIM_RADIUS ) };
+		const int pitch = s.pitch = g.x2 - g.x1 + 2;
+		const int size = pitch * (g.y2 - g.y1 + 2);
+		vector<uint>& sumX = s.x, &sumXX = s.xx, &sumXY = s.xy;
+		sumX.resize( size ), sumXX.resize( size ), sumXY.resize( size );
+		fill( sumX.begin(), sumX.begin() + pitch, 0 );
+		fill( sumXX.begin(), sumXX.begin() + pitch, 0 );
+		fill( sumXY.begin(), sumXY.begin() + pitch, 0 );
+		for (int y = g.y1; y <= g.y2; y++)
+		{
+			const int row = (y - g.y1 + 1) * pitch;
+			sumX[row] = sumXX[row] = sumXY[row] = 0;
+			uint rx = 0, rxx = 0, rxy = 0;
+			const uint* src = screen->pixels[y].data();
+			const int* lr = &refLuma[y * SCRWIDTH];
+			for (int x = g.x1, i = row + 1; x <= g.x2; x++, i++)
+			{
+				const uint u = (uint)Luma( src[x] );
+				rx += u, rxx += u * u, rxy += u * (uint)lr[x];
+				sumX[i] = sumX[i - pitch] + rx, sumXX[i] = sumXX[i - pitch] + rxx, sumXY[i] = sumXY[i - pitch] + rxy;
+			}
+		}
+	}
+	// sum over the window around (x, y), clipped to the screen
+	static uint Window( const Sums& s, const vector<uint>& v, int x, int y )
+	{
+		const int wx1 = max( 0, x - SSIM_RADIUS ) - s.g.x1, wx2 = min( SCRWIDTH - 1, x + SSIM_RADIUS ) - s.g.x1 + 1;
+		const int wy1 = max( 0, y - SSIM_RADIUS ) - s.g.y1, wy2 = min( SCRHEIGHT - 1, y + SSIM_RADIUS ) - s.g.y1 + 1;
+		return v[wy2 * s.pitch + wx2] - v[wy1 * s.pitch + wx2] - v[wy2 * s.pitch + wx1] + v[wy1 * s.pitch + wx1];
+	}
+	void Prepare( Surface* screen, const Rect& r ) { Integrate( screen, r ); }
+	__int64 ScoreRow( Surface* screen, int y, int x1, int n, const int* err, int* out );
+	// error of pixel (x, y) into out[k]; returns the change against err[k]
+	int Pixel( const Sums& s, int x, int y, int k, const int* err, int* out )
+	{
+		const int wx = min( SCRWIDTH - 1, x + SSIM_RADIUS ) - max( 0, x - SSIM_RADIUS ) + 1;
+		const int wy = min( SCRHEIGHT - 1, y + SSIM_RADIUS ) - max( 0, y - SSIM_RADIUS ) + 1;
+		const int i = y * SCRWIDTH + x;
+		const float inv = 1 / (float)(wx * wy);
+		const float mx = Window( s, s.x, x, y ) * inv, my = refSum[i] * inv, mxy = mx * my;
+		const float vx = Window( s, s.xx, x, y ) * inv - mx * mx, vy = refSq[i] * inv - my * my;
+		const float cxy = Window( s, s.xy, x, y ) * inv - mxy;
+		const float ssim = ((2 * mxy + C1) * (2 * cxy + C2)) / ((mx * mx + my * my + C1) * (vx + vy + C2));
+		out[k] = (int)((1 - ssim) * 65536);
+		return out[k] - err[k];
+	}
+	static constexpr float C1 = 6.5025f, C2 = 58.5225f;		// (0.01 * 255)^2, (0.03 * 255)^2
+	vector<int> refLuma, refSum, refSq;							// reference luma and its window sums
+};
+
+#if SIMD_EVAL && !defined( USE_ARM )
+// window sums of 8 pixels; p points at the integral image entry left
+// of the first window's top row
+AVX2_TARGET static inline __m256 Window8( const uint* p, int height )
+{
+	const int width = 2 * SSIM_RADIUS + 1;
+	const __m256i a = _mm256_loadu_si256( (const __m256i*)p ), b = _mm256_loadu_si256( (const __m256i*)(p + width) );
+	const __m256i c = _mm256_loadu_si256( (const __m256i*)(p + height) ), d = _mm256_loadu_si256( (const __m256i*)(p + height + width) );
+	return _mm256_cvtepi32_ps( _mm256_add_epi32( _mm256_sub_epi32( _mm256_sub_epi32( d, b ), c ), a ) );
+}
+
+// pixels x1..x1+n-1 of row y, all with a window inside the screen
+AVX2_TARGET static __int64 SSIMRowDelta8( const SSIMMetric& m, const SSIMMetric::Sums& s, int y, int x1, int n, const int* err, int* out )
+{
+	const int R = SSIM_RADIUS, top = (y - R - s.g.y1) * s.pitch, height = (2 * R + 1) * s.pitch;
+	const __m256 C1 = _mm256_set1_ps( SSIMMetric::C1 ), C2 = _mm256_set1_ps( SSIMMetric::C2 ), two = _mm256_set1_ps( 2 );
+	const __m256 inv = _mm256_set1_ps( 1 / (float)((2 * R + 1) * (2 * R + 1)) );
+	__int64 delta = 0;
+	int k = 0;
+	for (; k + 8 <= n; k += 8)
+	{
+		const int x = x1 + k;
+		const int i = y * SCRWIDTH + x;
+		const int o = top + x - R - s.g.x1;
+		const __m256 mx = _mm256_mul_ps( Window8( &s.x[o], height ), inv );
+		const __m256 my = _mm256_mul_ps( _mm256_cvtepi32_ps( _mm256_loadu_si256( (const __m256i*)&m.refSum[i] ) ), inv );
+		const __m256 mxy = _mm256_mul_ps( mx, my );
+		const __m256 vx = _mm256_sub_ps( _mm256_mul_ps( Window8( &s.xx[o], height ), inv ), _mm256_mul_ps( mx, mx ) );
+		const __m256 vy = _mm256_sub_ps( _mm256_mul_ps( _mm256_cvtepi32_ps( _mm256_loadu_si256( (const __m256i*)&m.refSq[i] ) ), inv ),
+			_mm256_mul_ps( my, my ) );
+		const __m256 cxy = _mm256_sub_ps( _mm256_mul_ps( Window8( &s.xy[o], height ), inv ), mxy );
+		const __m256 num = _mm256_mul_ps( _mm256_add_ps( _mm256_mul_ps( two, mxy ), C1 ), _mm256_add_ps( _mm256_mul_ps( two, cxy ), C2 ) );
+		const __m256 den = _mm256_mul_ps( _mm256_add_ps( _mm256_add_ps( _mm256_mul_ps( mx, mx ), _mm256_mul_ps( my, my ) ), C1 ),
+			_mm256_add_ps( _mm256_add_ps( vx, vy ), C2 ) );
+		const __m256 ssim = _mm256_div_ps( num, den );
+		const __m256i e = _mm256_cvttps_epi32( _mm256_mul_ps( _mm256_sub_ps( _mm256_set1_ps( 1 ), ssim ), _mm256_set1_ps( 65536 ) ) );
+		_mm256_storeu_si256( (__m256i*)(out + k), e );
+		ALIGN( 32 ) int part[8];
+		_mm256_store_si256( (__m256i*)part, _mm256_sub_epi32( e, _mm256_loadu_si256( (const __m256i*)(err + k) ) ) );
+		for (int j = 0; j < 8; j++) delta += part[j];
+	}
+	return delta;
+}
+#endif
+
+__int64 SSIMMetric::ScoreRow( Surface* /* screen */, int y, int x1, int n, const int* err, int* out )
+{
+	const Sums& s = Work();
+	__int64 delta = 0;
+	int x = x1;
+#if SIMD_EVAL && !defined( USE_ARM )
+	// the vector kernel covers the pixels whose window is not clipped
+	const int inner1 = max( x1, SSIM_RADIUS ), inner2 = min( x1 + n, SCRWIDTH - SSIM_RADIUS );
+	const bool rowInside = y >= SSIM_RADIUS && y < SCRHEIGHT - SSIM_RADIUS;
+	if (CPUCaps::HW_AVX2 && rowInside && inner2 - inner1 >= 8)
+	{
+		for (; x < inner1; x++) delta += Pixel( s, x, y, x - x1, err, out );
+		const int count = (inner2 - inner1) & ~7;
+		delta += SSIMRowDelta8( *this, s, y, inner1, count, err + (inner1 - x1), out + (inner1 - x1) );
+		x = inner1 + count;
+	}
+#endif
+	for (; x < x1 + n; x++) delta += Pixel( s, x, y, x - x1, err, out );
+	return delta;
+}
+
+Metric* metric;												// the metric the optimizer minimizes
+
+// -----------------------------------------------------------
+// Parallel scoring
+// Rows of a rectangle are scored in bands, one job per band, each
+// into its own 64-bit sum. Integer sums do not depend on the order
+// they are added in, so the result is the same for any thread
+// count. Rectangles below EVAL_MT_PIXELS are not worth dispatching
+// and are scored on the calling thread.
+// -----------------------------------------------------------
+#define EVAL_MT_PIXELS	65536
+#define EVAL_MAXBANDS	64
+
+class ScoreBandJob : public Job
+{
+public:
+	void Main()
+	{
+		sum = 0;
+		if (!err) { sum = metric->RowsError( screen, r.y1, r.y2, rows ); return; }
+		// per-pixel errors, as ErrorBuffer::Stage needs them
+		const int w = r.x2 - r.x1 + 1;
+		metric->Prepare( screen, r );
+		for (int y = r.y1, k = 0; y <= r.y2; y += step, k++)
+			sum += rows[k] = metric->ScoreRuns( screen, y, r.x1, w, err + (y - r.y1) * SCRWIDTH, out + k * w );
+	}
+	Surface* screen;
+	Rect r;
+	int step;												// score every step-th row, from r.y1
+	const int* err;											// errors to diff against, pitch SCRWIDTH
+	int* out;												// new errors of the scored rows, pitch r width
+	__int64* rows, sum;
+};
+
+// score rows r.y1..r.y2 of r; with err, fill out like ErrorBuffer::Stage
+// and return the change, otherwise r must span full rows and the
+// total error is returned. rows receives the per-row results. With
+// err, only every step-th row can be scored; rows and out then hold
+// just those rows.
+__int64 ScoreRows( Surface* screen, const Rect& r, const int* err, int* out, __int64* rows, int step = 1 )
+{
+	static ScoreBandJob band[EVAL_MAXBANDS];
+	const int w = r.x2 - r.x1 + 1, h = (r.y2 - r.y1) / step + 1;
+	int bands = 1;
+#if EVAL_MT
+	JobManager* jm = JobManager::GetJobManager();
+	if (w * h >= EVAL_MT_PIXELS && jm->GetNumThreads() > 1)
+		bands = min( min( h, EVAL_MAXBANDS ), (int)jm->GetNumThreads() * 2 );
+#endif
+	const int height = (h + bands - 1) / bands;				// scored rows per band
+	bands = (h + height - 1) / height;
+	for (int b = 0; b < bands; b++)
+	{
+		const int y = r.y1 + b * height * step;
+		ScoreBandJob& job = band[b];
+		job.screen = screen, job.r = { r.x1, y, r.x2, min( r.y2, y + (height - 1) * step ) }, job.step = step;
+		job.rows = rows + b * height;
+		job.err = err ? err + b * height * step * SCRWIDTH : 0, job.out = out ? out + b * height * w : 0;
+	}
+	if (bands == 1) band[0].Main(); else
+	{
+#if EVAL_MT
+		for (int b = 0; b < bands; b++) jm->AddJob2( &band[b] );
+		jm->RunJobs();
+#endif
+	}
+	__int64 sum = 0;
+	for (int b = 0; b < bands; b++) sum += band[b].sum;
+	return sum;
+}
+
+// -----------------------------------------------------------
+// Dirty rectangles
+// A mutation only changes pixels inside the bounds of the old and
+// the new line. A uniform grid of GRIDCELL-sized cells records which
+// lines cross each cell, so such a rectangle can be re-rendered
+// from white using only the lines that touch it, in z-order.
+// -----------------------------------------------------------
+#define GRIDCELL	32
+#define GRIDW		((SCRWIDTH + GRIDCELL - 1) / GRIDCELL)
+#define GRIDH		((SCRHEIGHT + GRIDCELL - 1) / GRIDCELL)
+
+thread_local uint lineStamp[LINES], stamp = 0;				// dedupe when collecting lines; 0: never
+
+// the cells the lines of one genome cross
+struct LineGrid
+{
+	void Index( int i, const LineSpan& span );
+	const vector<int>& InRect( const Rect& r, int last ) const;
+	vector<int> cellLines[GRIDW * GRIDH];						// line indices per cell, unordered
+	vector<int> lineCells[LINES];								// cells each line is registered in
+};
+
+LineGrid grid;													// the grid of lx1..lc
+
+// bounds of everything a line touches, including the paired pixels
+Rect Bounds( const Line& l )
+{
+	Rect r = { min( l.x1, l.x2 ) - 1, min( l.y1, l.y2 ), max( l.x1, l.x2 ) + 1, max( l.y1, l.y2 ) + 1 };
+	r.x1 = max( 0, r.x1 ), r.y1 = max( 0, r.y1 );
+	r.x2 = min( SCRWIDTH - 1, r.x2 ), r.y2 = min( SCRHEIGHT - 1, r.y2 );
+	return r;
+}
+
+Rect LineBounds( int i ) { return Bounds( GetLine( i ) ); }
+
+Rect Union( const Rect& a, const Rect& b )
+{
+	return { min( a.x1, b.x1 ), min( a.y1, b.y1 ), max( a.x2, b.x2 ), max( a.y2, b.y2 ) };
+}
+
+bool Overlaps( const Rect& a, const Rect& b )
+{
+	return a.x1 <= b.x2 && b.x1 <= a.x2 && a.y1 <= b.y2 && b.y1 <= a.y2;
+}
+
+// (re)register line i in the cells its span crosses
+void LineGrid::Index( int i, const LineSpan& span )
+{
+	static thread_local vector<int> cells;
+	static thread_local bool mark[GRIDW * GRIDH] = {};
+	cells.clear();
+	for (const uint e : span.pix)
+	{
+		const int cell = (int)(e >> 19) / GRIDCELL * GRIDW + (int)((e >> 9) & 1023) / GRIDCELL;
+		if (!mark[cell]) mark[cell] = true, cells.push_back( cell );
+	}
+	for (const int cell : cells) mark[cell] = false;
+	sort( cells.begin(), cells.end() );
+	if (cells == lineCells[i]) return;
+	for (const int cell : lineCells[i])
+	{
+		vector<int>& c = cellLines[cell];
+		c.erase( find( c.begin(), c.end(), i ) );
+	}
+	for (const int cell : cells) cellLines[cell].push_back( i );
+	lineCells[i] = cells;
+}
+
+// the lines below 'last' that touch r, in z-order
+const vector<int>& LineGrid::InRect( const Rect& r, int last ) const
+{
+	static thread_local vector<int> lines;
+	lines.clear();
+	if (++stamp == 0)
+	{
+		// wrapped: old stamps could match again
+		fill( lineStamp, lineStamp + LINES, 0u );
+		stamp = 1;
+	}
+	for (int cy = r.y1 / GRIDCELL; cy <= r.y2 / GRIDCELL; cy++)
+		for (int cx = r.x1 / GRIDCELL; cx <= r.x2 / GRIDCELL; cx++)
+			for (const int j : cellLines[cy * GRIDW + cx])
+				if (j < last && lineStamp[j] != stamp) lineStamp[j] = stamp, lines.push_back( j );
+	sort( lines.begin(), lines.end() );
+	return lines;
+}
+
+void IndexLine( int i ) { grid.Index( i, GetSpan( i ) ); }
+const vector<int>& LinesInRect( const Rect& r, int last ) { return grid.InRect( r, last ); }
+
+// clear r to white and redraw all lines below 'last' that touch it;
+// returns the number of lines drawn. Pixels outside the region of
+// interest are left alone. With STEP, only every STEP-th row of r.
+template <int STEP = 1> int RenderRect( Surface* screen, const Rect& rect, int last )
+{
+#if ROI_MASK
+	Rect r = roi.Clip( rect );
+	// keep the rows of rect that STEP selects, where clipping moved the top
+	r.y1 = rect.y1 + (r.y1 - rect.y1 + STEP - 1) / STEP * STEP;
+	if (r.x2 < 0 || r.y1 > r.y2) return 0;
+#else
+	const Rect& r = rect;
+#endif
+	const vector<int>& lines = LinesInRect( r, last );
+	for (int y = r.y1; y <= r.y2; y += STEP)
+		for (int x = r.x1; x <= r.x2; x++)
+			if (!ROI_MASK || roi.Draws( x, y )) screen->pixels[y][x] = 0xFFFFFFFF;
+	for (const int j : lines) DrawSpanClipped<STEP>( screen, j, r );
+	return (int)lines.size();
+}
+
+// -----------------------------------------------------------
+// Error buffer
+// The per-pixel error of the canvas, with per-row sums, per-tile
+// sums and the total, so a candidate is scored by diffing only the
+// rectangle it re-rendered. Stage scores the rectangle and returns
+// the change in total error; Commit makes the staged errors
+// current, Rollback drops them, mirroring UndoMutation.
+// -----------------------------------------------------------
+#define HEATTILE	32
+#define HEATW		((SCRWIDTH + HEATTILE - 1) / HEATTILE)
+#define HEATH		((SCRHEIGHT + HEATTILE - 1) / HEATTILE)
+
+// Fenwick tree over the tile errors: both changing a tile and
+// finding the tile a running sum falls in take O(log tiles)
+struct TileTree
+{
+	void Init( int n ) { tree.assign( n + 1, 0 ); }
+	void Add( int i, __int64 d ) { for (i++; i < (int)tree.size(); i += i & -i) tree[i] += d; }
+	int Find( __int64 u ) const
+	{
+		// tile i with prefix( i ) <= u < prefix( i + 1 )
+		int i = 0, step = 1;
+		while (step * 2 < (int)tree.size()) step *= 2;
+		for (; step; step >>= 1)
+			if (i + step < (int)tree.size() && tree[i + step] <= u) i += step, u -= tree[i];
+		return i;
+	}
+	vector<__int64> tree;
+};
+
+struct ErrorBuffer
+{
+	void Init( Surface* screen )
+	{
+		err.assign( SCRWIDTH * SCRHEIGHT, 0 );
+		rowSum.assign( SCRHEIGHT, 0 );
+		tileSum.assign( HEATW * HEATH, 0 );
+		hot.Init( HEATW * HEATH );
+		total = 0;
+		Stage( screen, { 0, 0, SCRWIDTH - 1, SCRHEIGHT - 1 } );
+		Commit();
+	}
+	// the pixels whose error changes with the pixels in 'changed'; with a
+	// windowed metric, errors change around the changed pixels too
+	static Rect Reach( const Rect& changed )
+	{
+		const int R = metric->Radius();
+		return { max( 0, changed.x1 - R ), max( 0, changed.y1 - R ), min( SCRWIDTH - 1, changed.x2 + R ), min( SCRHEIGHT - 1, changed.y2 + R ) };
+	}
+	__int64 Stage( Surface* screen, const Rect& changed )
+	{
+		const Rect r = Reach( changed );
+		const int w = r.x2 - r.x1 + 1, h = r.y2 - r.y1 + 1;
+		staged = r;
+		stage.resize( w * h );
+		stageRow.resize( h );
+		stageDelta = ScoreRows( screen, r, &err[r.y1 * SCRWIDTH + r.x1], stage.data(), stageRow.data() );
+		return stageDelta;
+	}
+	void Commit()
+	{
+		const Rect& r = staged;
+		const int w = r.x2 - r.x1 + 1;
+		for (int y = r.y1; y <= r.y2; y++)
+		{
+			const int* s = &stage[(y - r.y1) * w] - r.x1;
+			int* e = &err[y * SCRWIDTH];
+			__int64* tiles = &tileSum[y / HEATTILE * HEATW];
+			for (int x = r.x1; x <= r.x2;)
+			{
+				const int tile = x / HEATTILE, end = min( r.x2 + 1, (tile + 1) * HEATTILE );
+				__int64 d = 0;
+				for (; x < end; x++) d += s[x] - e[x], e[x] = s[x];
+				tiles[tile] += d;
+				if (d) hot.Add( (int)(tiles - tileSum.data()) + tile, d );
+			}
+			rowSum[y] += stageRow[y - r.y1];
+		}
+		total += stageDelta;
+	}
+	void Rollback() { stageDelta = 0; }
+	// replace all per-pixel errors with ones scored elsewhere
+	void Load( const vector<int>& pix )
+	{
+		staged = { 0, 0, SCRWIDTH - 1, SCRHEIGHT - 1 };
+		stage = pix, stageRow.resize( SCRHEIGHT ), stageDelta = 0;
+		for (int y = 0; y < SCRHEIGHT; y++)
+		{
+			__int64 row = 0;
+			for (int x = 0; x < SCRWIDTH; x++) row += pix[y * SCRWIDTH + x];
+			stageDelta += stageRow[y] = row - rowSum[y];
+		}
+		Commit();
+	}
+	// stage errors that were scored elsewhere; the vectors are swapped in
+	void Adopt( const Rect& r, vector<int>& pix, vector<__int64>& rows, __int64 delta )
+	{
+		staged = r, stage.swap( pix ), stageRow.swap( rows ), stageDelta = delta;
+	}
+	vector<int> err;										// per-pixel error, SCRWIDTH * SCRHEIGHT
+	vector<__int64> rowSum;									// error per row
+	vector<__int64> tileSum;								// error per HEATTILE square tile
+	TileTree hot;											// tileSum, for sampling by error
+	__int64 total = 0;										// unscaled fitness
+	Rect staged = {};										// last staged rectangle
+	vector<int> stage;										// its per-pixel errors, packed rows
+	vector<__int64> stageRow;								// its change in error per row
+	__int64 stageDelta = 0;									// its change in total error
+} errors;
+
+// -----------------------------------------------------------
+// Sampled scoring
+// Most candidates lose, and rendering and scoring the rectangle
+// exactly spends a full pass to confirm that. A systematic sample
+// of every SAMPLE_STEP-th row, from a rotating start, is rendered
+// and scored first and estimates the change in error at a fraction
+// of the cost; the sampled rows are whole row segments, so they go
+// through the same SIMD kernels. A candidate is only rejected on
+// the sample when the estimate exceeds SAMPLE_Z standard errors
+// above 0 (or above the loss the acceptance policy allows, 'slack');
+// everything else, and every acceptance, gets the exact
+// render and score. The variance comes from successive differences
+// of the row deltas, the usual estimator for a systematic sample.
+// Windowed metrics read rows between the samples and are always
+// scored exactly.
+// -----------------------------------------------------------
+#define SAMPLE_STEP	4											// a power of 2
+#define SAMPLE_MIN	8											// sampled rows needed for an estimate
+#define SAMPLE_Z	2.0
+
+// render the sampled rows of r and estimate; the caller restores
+// the rectangle either way
+bool SampleRejects( Surface* screen, const Rect& r, __int64 slack = 0 )
+{
+	static vector<int> out;
+	static __int64 rows[SCRHEIGHT];
+	static int phase = 0;
+	const int w = r.x2 - r.x1 + 1, y1 = r.y1 + (phase = (phase + 1) % SAMPLE_STEP);
+	const int n = (r.y2 - y1) / SAMPLE_STEP + 1;
+	if (metric->Radius() > 0 || y1 > r.y2 || n < SAMPLE_MIN) return false;
+	RenderRect<SAMPLE_STEP>( screen, { r.x1, y1, r.x2, r.y2 }, LINES );
+	out.resize( n * w );
+	ScoreRows( screen, { r.x1, y1, r.x2, y1 + (n - 1) * SAMPLE_STEP }, &errors.err[y1 * SCRWIDTH + r.x1], out.data(), rows, SAMPLE_STEP );
+	double sum = (double)rows[0], sq = 0;
+	for (int k = 1; k < n; k++) sum += (double)rows[k], sq += (double)(rows[k] - rows[k - 1]) * (double)(rows[k] - rows[k - 1]);
+	const double variance = SAMPLE_STEP * (SAMPLE_STEP - 1.0) * n * sq / (2 * (n - 1));
+	return sum * SAMPLE_STEP - slack > SAMPLE_Z * sqrt( variance );
+}
+
+// -----------------------------------------------------------
+// Error heatmap
+// Where the remaining error sits, from the per-tile sums the error
+// buffer keeps up to date on every accepted mutation. HotPoint
+// uses them to aim new lines at the worst tiles. The heatmap
+// can be drawn over the screen (key H), or dumped as heatmap.bin
+// with a report of the worst tiles on stdout (key M). The dump
+// holds int32 HEATW, HEATH and HEATTILE, then HEATW * HEATH int64
+// tile sums, row by row.
+// -----------------------------------------------------------
+#define HEATREPORT	8											// tiles listed by ReportHeatmap
+
+bool showHeatmap = false;
+
+// tint every tile from blue (no error) to red (the worst tile)
+void DrawHeatmap( Surface* screen )
+{
+	if (errors.tileSum.empty()) return;
+	const __int64 worst = max( (__int64)1, *max_element( errors.tileSum.begin(), errors.tileSum.end() ) );
+	for (int y = 0; y < SCRHEIGHT; y++)
+	{
+		uint* row = screen->pixels[y].data();
+		for (int x = 0; x < SCRWIDTH; x++)
+		{
+			const uint t = (uint)(errors.tileSum[y / HEATTILE * HEATW + x / HEATTILE] * 255 / worst);
+			row[x] = ((row[x] >> 1) & 0x7f7f7f) + (((t << 16) | (255 - t)) >> 1 & 0x7f7f7f);
+		}
+	}
+}
+
+// a random pixel, with each tile picked in proportion to its error
+void HotPoint( int& x, int& y, uint& seed )
+{
+	const __int64 total = errors.total;
+	if (errors.tileSum.empty() || total <= 0)
+	{
+		x = RandomUInt( seed ) % SCRWIDTH, y = RandomUInt( seed ) % SCRHEIGHT;
+		return;
+	}
+	// initializers run in order; two calls in one expression would not
+	const uint hi = RandomUInt( seed ), lo = RandomUInt( seed );
+	const __int64 u = (__int64)(((unsigned __int64)hi << 32 | lo) % (unsigned __int64)total);
+	const int tile = errors.hot.Find( u );
+	const int tx = tile % HEATW * HEATTILE, ty = tile / HEATW * HEATTILE;
+	x = tx + RandomUInt( seed ) % min( HEATTILE, SCRWIDTH - tx );
+	y = ty + RandomUInt( seed ) % min( HEATTILE, SCRHEIGHT - ty );
+}
+
+void ReportHeatmap()
+{
+	if (errors.tileSum.empty()) return;
+	if (errors.total <= 0) { printf( "no error left in any tile\n" ); return; }	// a perfect match
+	vector<int> order( HEATW * HEATH );
+	for (int i = 0; i < HEATW * HEATH; i++) order[i] = i;
+	partial_sort( order.begin(), order.begin() + HEATREPORT, order.end(),
+		[]( int a, int b ) { return errors.tileSum[a] > errors.tileSum[b]; } );
+	__int64 top = 0;
+	for (int k = 0; k < HEATREPORT; k++) top += errors.tileSum[order[k]];
+	printf( "worst %i of %i tiles hold %.1f%% of the error:\n", HEATREPORT, HEATW * HEATH, 100.0 * top / errors.total );
+	for (int k = 0; k < HEATREPORT; k++)
+	{
+		const int i = order[k];
+		printf( "  tile %2i,%2i (pixels %3i,%3i): %lld (%.2f%%)\n", i % HEATW, i / HEATW,
+			i % HEATW * HEATTILE, i / HEATW * HEATTILE, errors.tileSum[i], 100.0 * errors.tileSum[i] / errors.total );
+	}
+}
+
+void DumpHeatmap( const char* file )
+{
+	if (errors.tileSum.empty()) return;
+	FILE* f = fopen( file, "wb" );
+	if (!f) return;
+	const int header[3] = { HEATW, HEATH, HEATTILE };
+	fwrite( header, 4, 3, f );
+	fwrite( errors.tileSum.data(), 8, HEATW * HEATH, f );
+	fclose( f );
+}
+
+// -----------------------------------------------------------
+// Resolution pyramid
+// Candidates are first scored at 2x (and 4x) reduced resolution.
+// There a line is drawn from a coarse span: the coverage of its
+// full-resolution span summed per coarse pixel. Each level holds
+// the coarse rendering of the accepted generation; a candidate
+// re-renders its rectangle in place, and the level is restored
+// when the candidate is rejected. Only candidates that improve at
+// every level are rendered and scored at full resolution.
+// -----------------------------------------------------------
+struct PyramidLevel
+{
+	void Init( int levelShift )
+	{
+		shift = levelShift;
+		w = (SCRWIDTH + (1 << shift) - 1) >> shift, h = (SCRHEIGHT + (1 << shift) - 1) >> shift;
+		// box-filtered reference
+		ref.assign( w * h, 0 );
+		for (int y = 0; y < h; y++) for (int x = 0; x < w; x++)
+		{
+			uint r = 0, g = 0, b = 0, n = 0;
+			for (int v = y << shift; v < min( SCRHEIGHT, (y + 1) << shift ); v++)
+				for (int u = x << shift; u < min( SCRWIDTH, (x + 1) << shift ); u++, n++)
+				{
+					const uint p = reference->pixels[v][u];
+					r += (p >> 16) & 255, g += (p >> 8) & 255, b += p & 255;
+				}
+			ref[y * w + x] = (r / n) << 16 | (g / n) << 8 | b / n;
+		}
+#if ROI_MASK
+		// a coarse pixel is scored if any of its pixels is
+		runs.clear();
+		if (roi.active)
+		{
+			vector<BYTE> coarse( w );
+			runs.resize( h );
+			for (int y = 0; y < h; y++)
+			{
+				fill( coarse.begin(), coarse.end(), ROI_SKIP );
+				for (int v = y << shift; v < min( SCRHEIGHT, (y + 1) << shift ); v++)
+					for (const RowSpan& s : roi.row[v])
+						fill( coarse.begin() + (s.x1 >> shift), coarse.begin() + (s.x2 >> shift) + 1, ROI_SCORE );
+				MaskRuns( coarse.data(), w, runs[y] );
+			}
+		}
+#endif
+		canvas.assign( w * h, 0xFFFFFFFF );
+		const Rect all = { 0, 0, w - 1, h - 1 };
+		for (int i = 0; i < LINES; i++) Draw( i, all );
+	}
+	const LineSpan& GetSpan( int i )
+	{
+		LineSpan& s = span[i];
+		if (s.x1 == lx1[i] && s.y1 == ly1[i] && s.x2 == lx2[i] && s.y2 == ly2[i]) return s;
+		s.x1 = lx1[i], s.y1 = ly1[i], s.x2 = lx2[i], s.y2 = ly2[i];
+		// gather line coverage per coarse pixel, then turn it into a blend weight
+		static vector<uint> cover;
+		cover.clear();
+		for (const uint e : ::GetSpan( i ).pix)
+		{
+			const uint x = (e >> 9) & 1023, y = e >> 19, weight = e & 511;
+			cover.push_back( ((y >> shift) << 10 | (x >> shift)) << 9 | (weight == SPAN_SOLID ? 255 : 255 - weight) );
+		}
+		sort( cover.begin(), cover.end() );
+		s.pix.clear();
+		for (size_t k = 0; k < cover.size();)
+		{
+			const uint pos = cover[k] >> 9;
+			uint sum = 0;
+			for (; k < cover.size() && (cover[k] >> 9) == pos; k++) sum += cover[k] & 511;
+			s.pix.push_back( pos << 9 | (255 - min( 255u, sum >> (2 * shift) )) );
+		}
+		return s;
+	}
+	// draw line i, clipped to coarse rectangle r
+	void Draw( int i, const Rect& r )
+	{
+		const uint clrLine = lc[i];
+		const auto grayl = WuGray( clrLine );
+		for (const uint e : GetSpan( i ).pix)
+		{
+			const int x = (e >> 9) & 1023, y = e >> 19;
+			if (x < r.x1 || x > r.x2 || y < r.y1 || y > r.y2) continue;
+			uint& pixel = canvas[y * w + x];
+			pixel = WuBlend( pixel, clrLine, grayl, e & 511 );
+		}
+	}
+	__int64 Error( const Rect& r )
+	{
+		__int64 diff = 0;
+#if ROI_MASK
+		if (!runs.empty())
+		{
+			for (int y = r.y1; y <= r.y2; y++) for (const RowSpan& s : runs[y]) if (s.x2 >= r.x1 && s.x1 <= r.x2)
+			{
+				const int x1 = max( r.x1, s.x1 ), x2 = min( r.x2, s.x2 );
+				diff += RowError( &canvas[y * w + x1], &ref[y * w + x1], x2 - x1 + 1 );
+			}
+			return diff;
+		}
+#endif
+		for (int y = r.y1; y <= r.y2; y++) diff += RowError( &canvas[y * w + r.x1], &ref[y * w + r.x1], r.x2 - r.x1 + 1 );
+		return diff;
+	}
+	// re-render the coarse rectangle covering full-resolution rectangle r;
+	// returns the change in error
+	__int64 Try( const Rect& r )
+	{
+		tried = { r.x1 >> shift, r.y1 >> shift, r.x2 >> shift, r.y2 >> shift };
+		const Rect& c = tried;
+		saved.clear();
+		for (int y = c.y1; y <= c.y2; y++)
+			saved.insert( saved.end(), canvas.begin() + y * w + c.x1, canvas.begin() + y * w + c.x2 + 1 );
+		const __int64 before = Error( c );
+		for (int y = c.y1; y <= c.y2; y++) fill( canvas.begin() + y * w + c.x1, canvas.begin() + y * w + c.x2 + 1, 0xFFFFFFFF );
+		const Rect covered = { c.x1 << shift, c.y1 << shift,
+			min( SCRWIDTH - 1, ((c.x2 + 1) << shift) - 1 ), min( SCRHEIGHT - 1, ((c.y2 + 1) << shift) - 1 ) };
+		for (const int j : LinesInRect( covered, LINES )) Draw( j, c );
+		return Error( c ) - before;
+	}
+	// undo the last Try
+	void Restore()
+	{
+		const Rect& c = tried;
+		const uint* p = saved.data();
+		for (int y = c.y1; y <= c.y2; y++, p += c.x2 - c.x1 + 1)
+			copy( p, p + c.x2 - c.x1 + 1, canvas.begin() + y * w + c.x1 );
+	}
+	int shift = 0, w = 0, h = 0;
+	vector<uint> canvas, ref;									// coarse accepted generation and reference
+	vector<uint> saved;											// canvas under the last Try
+	Rect tried = {};											// coarse rectangle of the last Try
+	vector<vector<RowSpan>> runs;								// scored coarse runs per row, if masked
+	LineSpan span[LINES];										// coarse spans, same layout as span[]
+} pyramid[2];
+
+// score a candidate (IndexLine'd, covering r) at the coarse levels,
+// coarsest first; a level that does not improve rejects it. With
+// 'slack' (full-resolution error), a level may lose up to that much,
+// scaled to its pixel count.
+bool PyramidAccepts( const Rect& r, __int64 slack = 0 )
+{
+	for (int level = 0; level < PYRAMID; level++) if (pyramid[level].Try( r ) >= slack >> (2 * pyramid[level].shift))
+	{
+		for (int k = level; k >= 0; k--) pyramid[k].Restore();
+		return false;
+	}
+	return true;
+}
+
+// the candidate passed the pyramid but was rejected at full resolution
+void PyramidReject()
+{
+	for (int level = 0; level < PYRAMID; level++) pyramid[level].Restore();
+}
+
+// -----------------------------------------------------------
+// Acceptance policy
+// Bound returns the fitness a candidate has to stay below to be
+// accepted; Step is called once per mutation tried, with the
+// fitness after it. Hill climbing only accepts improvements.
+// Simulated annealing accepts a loss of d with probability
+// exp( -d / T ): it draws u from the caller's random state and
+// returns fitness - T * ln( u ), which is the same test, but known
+// before scoring, so the bounded and early-out scorers keep
+// working. The temperature follows a cooling schedule:
+// - linear: from ANNEAL_T0 to 0 in ANNEAL_STEPS mutations;
+// - exponential: times ANNEAL_ALPHA per mutation;
+// - adaptive: exponential, back to ANNEAL_T0 after ANNEAL_PATIENCE
+//   mutations without a new best.
+// The schedule counts mutations scored, not steps: a step that
+// scores CANDIDATES mutations cools as much as CANDIDATES steps.
+// The temperature is computed from that count, in double, rather
+// than compounded per mutation, so float rounding does not drift.
+// Since the current genome may be worse than one seen before, the
+// best genome is kept in 'best', and that is what Shutdown saves.
+// -----------------------------------------------------------
+class Acceptance
+{
+public:
+	virtual ~Acceptance() = default;
+	virtual int Bound( int fitness, uint& /* seed */ ) { return fitness; }
+	virtual void Step( int /* fitness */, int /* mutations */ = 1 ) {}
+	virtual float Temperature() { return 0; }
+};
+
+class Cooling
+{
+public:
+	virtual ~Cooling() = default;
+	// the temperature after k mutations since the start or the last reheat
+	virtual double At( __int64 k ) = 0;
+	// restart from ANNEAL_T0 once 'stalled' mutations went by since the
+	// last new best
+	virtual bool Reheats( __int64 /* stalled */ ) { return false; }
+};
+
+class LinearCooling : public Cooling
+{
+public:
+	double At( __int64 k ) { return max( 0.0, ANNEAL_T0 * (1 - (double)k / ANNEAL_STEPS) ); }
+};
+
+class ExpCooling : public Cooling
+{
+public:
+	double At( __int64 k ) { return ANNEAL_T0 * pow( ANNEAL_ALPHA, (double)k ); }
+};
+
+class AdaptiveCooling : public ExpCooling
+{
+public:
+	bool Reheats( __int64 stalled ) { return stalled >= ANNEAL_PATIENCE; }
+};
+
+class Annealing : public Acceptance
+{
+public:
+	Annealing( Cooling* schedule ) : cooling( schedule ) {}
+	~Annealing() { delete cooling; }
+	int Bound( int fitness, uint& seed )
+	{
+		if (t <= 0) return fitness;
+		const double u = max( 1e-12, (double)RandomFloat( seed ) );
+		return fitness + (int)min( -t * log( u ), (double)(INT_MAX - fitness) );
+	}
+	void Step( int fitness, int mutations = 1 )
+	{
+		if (fitness < best) best = fitness, stalled = 0; else stalled += mutations;
+		if (cooling->Reheats( stalled )) cooled = stalled = 0; else cooled += mutations;
+		t = (float)cooling->At( cooled );
+	}
+	float Temperature() { return t; }
+	Cooling* cooling;
+	float t = ANNEAL_T0;
+	int best = INT_MAX;
+	__int64 cooled = 0, stalled = 0;							// mutations since the last reheat, the last new best
+};
+
+Acceptance* NewAcceptance()
+{
+	if (ACCEPT == ACCEPT_HILL) return new Acceptance();
+	if (COOLING == COOLING_LINEAR) return new Annealing( new LinearCooling() );
+	if (COOLING == COOLING_EXP) return new Annealing( new ExpCooling() );
+	return new Annealing( new AdaptiveCooling() );
+}
+
+Acceptance* policy;												// the policy of the shared genome
+
+// the best genome seen, once the current one got worse
+struct BestGenome
+{
+	// the current genome (before mutation m, if given) may be left for
+	// a worse one; keep it if it beats the best
+	void Leave( int current, const Mutation& m = { -1, {} } )
+	{
+		if (current >= fitness) return;
+		fitness = current;
+		for (int i = 0; i < LINES; i++) line[i] = GetLine( i );
+		if (m.i >= 0) line[m.i] = m.before;
+	}
+	// put the best genome back, if the current one is worse
+	void Restore( int current )
+	{
+		if (fitness < current) for (int i = 0; i < LINES; i++) SetLine( i, line[i] );
+	}
+	int fitness = INT_MAX;
+	Line line[LINES];
+} best;
+
+// -----------------------------------------------------------
+// Parallel candidates
+// With CANDIDATES > 1, each optimizer step proposes that many
+// mutations of line lidx at once, one job per candidate. A job
+// mutates a copy of the line with its own random state, renders
+// the rectangle it touches into its own copy of the canvas, scores
+// it against the error buffer and puts the canvas back; the genome,
+// canvas, span cache and error buffer are only read. The best
+// candidate that improves fitness is then committed on the main
+// thread, and the rectangle it changed is copied into every private
+// canvas. The pyramid levels would be written by every job, so they
+// are not used in this mode.
+// With SPECULATIVE, candidate n mutates line lidx + n instead, and
+// every improving candidate is kept, best first, as long as the
+// pixels it rescored overlap none of the ones kept before it: the
+// lines it changed then lie outside their rectangles, so its render
+// and its error delta are still exact. Candidates that do overlap
+// are dropped; their lines come around again next pass.
+// -----------------------------------------------------------
+#if CANDIDATES > 256
+#error "the job manager runs at most 256 jobs at once"
+#endif
+#if CANDIDATES > 1 && !DIRTY_RECT
+#error "CANDIDATES renders through the line grid of DIRTY_RECT"
+#endif
+#if SPECULATIVE && CANDIDATES > LINES
+#error "SPECULATIVE mutates a different line per candidate"
+#endif
+
+class CandidateJob : public Job
+{
+public:
+	void Init( int n )
+	{
+		seed = 0x9E3779B9u * (n + 1);
+		scratch = new Surface( SCRWIDTH, SCRHEIGHT );
+		background = new Surface( SCRWIDTH, SCRHEIGHT );
+		canvas->CopyTo( scratch, 0, 0 );
+	}
+	void Main()
+	{
+		const Line before = GetLine( i );
+		line = before;
+		Mutate( i, line, seed, background );
+		BuildSpan( span, line.x1, line.y1, line.x2, line.y2 );
+		r = Union( Bounds( before ), Bounds( line ) );
+		scored = false, drawn = 0;
+#if ROI_MASK
+		// nothing the line covers is looked at: a change of 0
+		if (!roi.Touches( r ))
+		{
+			staged = { 0, 0, -1, -1 }, stageRow.clear(), delta = 0, scored = true;
+			return;
+		}
+#endif
+		Render();
+		// score like ErrorBuffer::Stage, on this thread
+		staged = ErrorBuffer::Reach( r );
+		const int w = staged.x2 - staged.x1 + 1, h = staged.y2 - staged.y1 + 1;
+		stage.resize( w * h ), stageRow.resize( h );
+		metric->Prepare( scratch, staged );
+		delta = 0;
+		for (int y = staged.y1; y <= staged.y2; y++)
+			delta += stageRow[y - staged.y1] = metric->ScoreRuns( scratch, y, staged.x1, w,
+				&errors.err[y * SCRWIDTH + staged.x1], &stage[(y - staged.y1) * w] );
+		scored = true;
+		Restore( r );
+	}
+	// RenderRect, with this candidate in place of line i
+	void Render()
+	{
+#if ROI_MASK
+		const Rect c = roi.Clip( r );
+#else
+		const Rect c = r;
+#endif
+		for (int y = c.y1; y <= c.y2; y++)
+			for (int x = c.x1; x <= c.x2; x++)
+				if (!ROI_MASK || roi.Draws( x, y )) scratch->pixels[y][x] = 0xFFFFFFFF;
+		bool done = false;
+		for (const int j : LinesInRect( c, LINES ))
+		{
+			if (j >= i && !done) DrawSpanClipped( scratch, span, line.c, c ), done = true, drawn++;
+			if (j != i) DrawSpanClipped( scratch, j, c ), drawn++;
+		}
+		if (!done) DrawSpanClipped( scratch, span, line.c, c ), drawn++;
+	}
+	// copy rectangle q of the shared canvas into the private one
+	void Restore( const Rect& q )
+	{
+		for (int y = q.y1; y <= q.y2; y++)
+			copy( canvas->pixels[y].begin() + q.x1, canvas->pixels[y].begin() + q.x2 + 1, scratch->pixels[y].begin() + q.x1 );
+	}
+	int i = 0;												// line to mutate
+	uint seed = 1;
+	Surface* scratch = 0, *background = 0;					// private canvas, FitColor background
+	Line line = {};											// the proposal
+	LineSpan span;											// its span
+	Rect r = {}, staged = {};								// rectangle it changes, and rescores
+	vector<int> stage;										// errors of staged, packed rows
+	vector<__int64> stageRow;
+	__int64 delta = 0;										// change in total error
+	bool scored = false;
+	int drawn = 0;											// lines rendered
+};
+
+#if CANDIDATES > 1
+CandidateJob candidate[CANDIDATES];
+
+// make candidate c part of the genome and the canvas; returns the
+// number of lines drawn
+int CommitCandidate( CandidateJob& c )
+{
+	if (c.delta >= 0) best.Leave( fitness );
+	SetLine( c.i, c.line );
+	GetSpan( c.i );											// jobs may not rebuild a span
+	IndexLine( c.i );
+	const int drawn = RenderRect( canvas, c.r, LINES );
+	errors.Adopt( c.staged, c.stage, c.stageRow, c.delta );
+	errors.Commit();
+	fitness = (int)(errors.total >> 5);
+	for (CandidateJob& other : candidate) other.Restore( c.r );
+	return drawn;
+}
+
+// one optimizer step on line lidx, or with SPECULATIVE on lines lidx
+// and up; returns the number of lines drawn
+int StepCandidates()
+{
+	JobManager* jm = JobManager::GetJobManager();
+	for (int n = 0; n < CANDIDATES; n++)
+		candidate[n].i = SPECULATIVE ? (lidx + n) % LINES : lidx, jm->AddJob2( &candidate[n] );
+	jm->RunJobs();
+	int drawn = 0;
+#if SPECULATIVE
+	static vector<CandidateJob*> order;
+	static vector<Rect> kept;
+	order.clear(), kept.clear();
+	for (CandidateJob& c : candidate)
+	{
+		drawn += c.drawn;
+		if (c.scored) order.push_back( &c );
+	}
+	sort( order.begin(), order.end(), []( const CandidateJob* a, const CandidateJob* b ) { return a->delta < b->delta; } );
+	for (CandidateJob* c : order)
+	{
+		if (any_of( kept.begin(), kept.end(), [&]( const Rect& k ) { return Overlaps( k, c->staged ); } )) continue;
+		if ((int)((errors.total + c->delta) >> 5) >= policy->Bound( fitness, seed )) continue;
+		kept.push_back( c->staged );
+		drawn += CommitCandidate( *c );
+	}
+#else
+	CandidateJob* win = 0;
+	for (CandidateJob& c : candidate)
+	{
+		drawn += c.drawn;
+		if (c.scored && (!win || c.delta < win->delta)) win = &c;
+	}
+	if (win && (int)((errors.total + win->delta) >> 5) < policy->Bound( fitness, seed )) drawn += CommitCandidate( *win );
+#endif
+	return drawn;
+}
+#endif
+
+// -----------------------------------------------------------
+// Island model
+// With ISLANDS > 1, that many copies of the genome are optimized
+// independently, one job per island per tick. An island owns its
+// lines, spans, canvas, per-pixel errors and random state, and
+// scores its mutations the way the error buffer does, so it shares
+// nothing writable with the others. It keeps its own line grid, and
+// renders a rectangle the way RenderRect does. New
+// lines are placed and colored at random: hot sampling and color
+// fitting read the shared error buffer and canvas.
+// Every MIGRATE ticks an island posts its genome to the next one
+// through a single-slot mailbox: a post is dropped while the
+// previous one has not been picked up, and the receiver adopts the
+// genome if it beats its own. The main thread shows the best island
+// and copies its genome to lx1..lc, so Shutdown saves that one; the
+// shared error buffer, which the heatmap shows, is loaded from that
+// island's errors when it is read.
+// -----------------------------------------------------------
+#if ISLANDS < 1 || ISLANDS > 256
+#error "the job manager runs at most 256 jobs at once"
+#endif
+#if ISLANDS > 1 && (CANDIDATES > 1 || !DIRTY_RECT)
+#error "ISLANDS replaces the DIRTY_RECT optimizer step; set CANDIDATES to 1"
+#endif
+
+struct Mailbox
+{
+	enum { EMPTY, WRITING, FULL };
+	atomic<int> state{ EMPTY };
+	Line genome[LINES];
+	__int64 total = 0;										// error of the genome
+};
+
+class Island : public Job
+{
+public:
+	void Init( int n, Mailbox* neighbour )
+	{
+		seed = 0x2545F491u * (n + 1), next = neighbour;
+		accept = NewAcceptance();
+		for (int i = 0; i < LINES; i++) line[i] = GetLine( i );
+		screen = new Surface( SCRWIDTH, SCRHEIGHT );
+		canvas->CopyTo( screen, 0, 0 );						// pixels outside the ROI are never drawn
+		err.resize( SCRWIDTH * SCRHEIGHT );
+		Rebuild();
+	}
+	// render and score the genome from scratch
+	void Rebuild()
+	{
+		const Rect all = { 0, 0, SCRWIDTH - 1, SCRHEIGHT - 1 };
+		for (int i = 0; i < LINES; i++)
+			BuildSpan( spans[i], line[i].x1, line[i].y1, line[i].x2, line[i].y2 ), grid.Index( i, spans[i] );
+		Render( all );
+		static thread_local vector<int> zero( SCRWIDTH );
+		metric->Prepare( screen, all );
+		total = 0;
+		for (int y = 0; y < SCRHEIGHT; y++) total += metric->ScoreRuns( screen, y, 0, SCRWIDTH, zero.data(), &err[y * SCRWIDTH] );
+	}
+	// RenderRect, on this island's genome
+	void Render( const Rect& rect )
+	{
+#if ROI_MASK
+		const Rect r = roi.Clip( rect );
+		if (r.x2 < 0) return;
+#else
+		const Rect& r = rect;
+#endif
+		for (int y = r.y1; y <= r.y2; y++)
+			for (int x = r.x1; x <= r.x2; x++)
+				if (!ROI_MASK || roi.Draws( x, y )) screen->pixels[y][x] = 0xFFFFFFFF;
+		for (const int i : grid.InRect( r, LINES )) DrawSpanClipped( screen, spans[i], line[i].c, r ), drawn++;
+	}
+	int Fitness() const { return (int)(total >> 5); }
+	void Main()
+	{
+		drawn = steps = 0;
+		Receive();
+		for (int k = 0; k < ITERATIONS; k++) Step();
+		if (++ticks % MIGRATE == 0) Send();
+	}
+	// mutate one line, and advance the cooling schedule
+	void Step()
+	{
+		const int i = idx;
+		idx = (idx + 1) % LINES, steps++;
+		const Line before = line[i];
+		Line l = before;
+		Mutate( i, l, seed );
+		const Rect r = Union( Bounds( before ), Bounds( l ) );
+		Try( i, before, l, r );
+		accept->Step( Fitness() );
+	}
+	// render and score line i changed from 'before' to l, covering r;
+	// keep it if the policy accepts it
+	void Try( int i, const Line& before, const Line& l, const Rect& r )
+	{
+#if ROI_MASK
+		// nothing the line covers is looked at: a change of 0
+		if (!roi.Touches( r ))
+		{
+			if (Fitness() < accept->Bound( Fitness(), seed ))
+				line[i] = l, BuildSpan( spans[i], l.x1, l.y1, l.x2, l.y2 ), grid.Index( i, spans[i] );
+			return;
+		}
+#endif
+		const int w = r.x2 - r.x1 + 1;
+		saved.resize( w * (r.y2 - r.y1 + 1) );
+		for (int y = r.y1; y <= r.y2; y++)
+			copy( screen->pixels[y].begin() + r.x1, screen->pixels[y].begin() + r.x2 + 1, saved.begin() + (y - r.y1) * w );
+		line[i] = l;
+		swap( spans[i], spare );
+		BuildSpan( spans[i], l.x1, l.y1, l.x2, l.y2 );
+		grid.Index( i, spans[i] );
+		Render( r );
+		const Rect s = ErrorBuffer::Reach( r );
+		const int sw = s.x2 - s.x1 + 1;
+		stage.resize( sw * (s.y2 - s.y1 + 1) );
+		metric->Prepare( screen, s );
+		__int64 delta = 0;
+		for (int y = s.y1; y <= s.y2; y++)
+			delta += metric->ScoreRuns( screen, y, s.x1, sw, &err[y * SCRWIDTH + s.x1], &stage[(y - s.y1) * sw] );
+		if ((int)((total + delta) >> 5) < accept->Bound( Fitness(), seed ))
+		{
+			for (int y = s.y1; y <= s.y2; y++)
+				copy( stage.begin() + (y - s.y1) * sw, stage.begin() + (y - s.y1 + 1) * sw, err.begin() + y * SCRWIDTH + s.x1 );
+			total += delta;
+			return;
+		}
+		for (int y = r.y1; y <= r.y2; y++)
+			copy( saved.begin() + (y - r.y1) * w, saved.begin() + (y - r.y1 + 1) * w, screen->pixels[y].begin() + r.x1 );
+		line[i] = before;
+		swap( spans[i], spare );
+		grid.Index( i, spans[i] );
+	}
+	// post the genome to the next island, unless its mailbox is taken
+	void Send()
+	{
+		int expected = Mailbox::EMPTY;
+		if (!next->state.compare_exchange_strong( expected, Mailbox::WRITING, memory_order_acquire )) return;
+		copy( line, line + LINES, next->genome );
+		next->total = total;
+		next->state.store( Mailbox::FULL, memory_order_release );
+	}
+	// adopt a posted genome that beats ours
+	void Receive()
+	{
+		if (inbox.state.load( memory_order_acquire ) != Mailbox::FULL) return;
+		if (inbox.total < total)
+		{
+			copy( inbox.genome, inbox.genome + LINES, line );
+			Rebuild();
+			adopted++;
+		}
+		inbox.state.store( Mailbox::EMPTY, memory_order_release );
+	}
+	Mailbox inbox;											// written by the previous island
+	Mailbox* next = 0;										// inbox of the next island
+	uint seed = 1;
+	Acceptance* accept = 0;									// this island's own policy and schedule
+	Line line[LINES];										// the genome
+	LineSpan spans[LINES], spare;							// its spans; spare holds the one replaced
+	LineGrid grid;											// its line grid
+	Surface* screen = 0;									// the genome, rendered
+	vector<int> err, stage;									// per-pixel error; errors of a candidate
+	vector<uint> saved;										// canvas under a candidate
+	__int64 total = 0;										// sum of err
+	int idx = 0, ticks = 0, adopted = 0;					// next line to mutate; ticks run; genomes adopted
+	int drawn = 0, steps = 0;								// lines rendered, mutations tried this tick
+};
+
+#if ISLANDS > 1
+Island island[ISLANDS];
+const Island* shown = 0;										// the best island of the last tick
+
+// one tick of every island; shows the best one. Returns the number
+// of lines drawn and adds the mutations tried to iterCount.
+int StepIslands( Surface* screen, int& iterCount )
+{
+	JobManager* jm = JobManager::GetJobManager();
+	for (Island& isl : island) jm->AddJob2( &isl );
+	jm->RunJobs();
+	Island* top = &island[0];
+	int drawn = 0;
+	for (Island& isl : island)
+	{
+		drawn += isl.drawn, iterCount += isl.steps;
+		if (isl.total < top->total) top = &isl;
+	}
+	for (int i = 0; i < LINES; i++) SetLine( i, top->line[i] );
+	fitness = top->Fitness();
+	best.Leave( fitness );
+	top->screen->CopyTo( screen, 0, 0 );
+	shown = top;
+	return drawn;
+}
+
+// bring the error buffer up to date with the island shown
+void SyncErrors()
+{
+	static const Island* synced = 0;
+	static __int64 syncedTotal = 0;
+	if (!shown || (shown == synced && shown->total == syncedTotal)) return;
+	errors.Load( shown->err );
+	synced = shown, syncedTotal = shown->total;
+}
+#endif
+
+// -----------------------------------------------------------
+// Tiled multithreaded rendering
+// Line spans are binned into screen tiles: each tile receives the
+// runs of span entries that fall inside it, in line order. Worker
+// threads then draw the tiles independently. Tiles are disjoint,
+// so the result is identical to drawing the lines serially.
+// -----------------------------------------------------------
+#define TILESIZE	64
+#define TILESX		((SCRWIDTH + TILESIZE - 1) / TILESIZE)
+#define TILESY		((SCRHEIGHT + TILESIZE - 1) / TILESIZE)
+
+struct SpanRun { int line, first, last; };						// span entries first..last-1 of a line
+
+class RenderTileJob : public Job
+{
+public:
+	void Main()
+	{
+		for (const SpanRun& run : runs) BlendRun( screen, run.line, run.first, run.last );
+	}
+	Surface* screen;
+	vector<SpanRun> runs;
+};
+
+void DrawLinesTiled( Surface* screen, int first, int last )
+{
+	static RenderTileJob tile[TILESX * TILESY];
+	for (int t = 0; t < TILESX * TILESY; t++) tile[t].screen = screen, tile[t].runs.clear();
+	for (int j = first; j < last; j++)
+	{
+		// (re)build spans here; the workers only read them
+		const vector<uint>& pix = GetSpan( j ).pix;
+		for (int k = 0, current = -1; k < (int)pix.size(); k++)
+		{
+			const int t = (int)(pix[k] >> 19) / TILESIZE * TILESX + (int)((pix[k] >> 9) & 1023) / TILESIZE;
+			if (t == current) tile[t].runs.back().last = k + 1;
+			else tile[t].runs.push_back( { j, k, k + 1 } ), current = t;
+		}
+	}
+	JobManager* jm = JobManager::GetJobManager();
+	for (int t = 0; t < TILESX * TILESY; t++) if (tile[t].runs.size()) jm->AddJob2( &tile[t] );
+	jm->RunJobs();
+}
+
+// -----------------------------------------------------------
+// Color fitting
+// Find the color that minimizes the error of line i over its own
+// footprint, blended over 'background' (with DIRTY_RECT, the
+// lines below i are first rendered into it). Lines drawn on top
+// are ignored; the full evaluation still decides acceptance.
+// A coarse-to-fine search per channel, repeated for all three,
+// touches only the footprint pixels.
+// -----------------------------------------------------------
+static __int64 FootprintError( const vector<uint>& pix, const vector<uint>& bg, const vector<uint>& ref, uint c )
+{
+	const auto grayl = WuGray( c );
+	__int64 err = 0;
+	for (size_t k = 0; k < pix.size(); k++)
+	{
+		const uint weight = pix[k] & 511;
+		err += PixelError( weight == SPAN_SOLID ? c : WuBlend( bg[k], c, grayl, weight ), ref[k] );
+	}
+	return err;
+}
+
+uint FitColor( int i, const Line& l, Surface* background )
+{
+	static thread_local vector<uint> bg, ref;
+	static thread_local LineSpan span;
+#if DIRTY_RECT
+	// the background is not kept around; render lines 0..i-1 under the line
+	RenderRect( background, Bounds( l ), i );
+#endif
+	BuildSpan( span, l.x1, l.y1, l.x2, l.y2 );
+	const vector<uint>& pix = ROI_MASK && roi.active ? roi.Scored( span.pix ) : span.pix;
+	bg.resize( pix.size() ), ref.resize( pix.size() );
+	for (size_t k = 0; k < pix.size(); k++)
+	{
+		const uint x = (pix[k] >> 9) & 1023, y = pix[k] >> 19;
+		bg[k] = background->pixels[y][x];
+		ref[k] = reference->pixels[y][x];
+	}
+	uint best = l.c;
+	__int64 bestErr = FootprintError( pix, bg, ref, best );
+	for (int shift = 0; shift < 24; shift += 8)
+	{
+		int lo = 0, hi = 255, center = (best >> shift) & 255;
+		for (int step = 16; step > 0; step >>= 2)
+		{
+			for (int v = lo; v <= hi; v += step)
+			{
+				const uint c = (best & ~(255u << shift)) | ((uint)v << shift);
+				const __int64 err = FootprintError( pix, bg, ref, c );
+				if (err < bestErr) bestErr = err, best = c, center = v;
+			}
+			lo = max( 0, center - step + 1 ), hi = min( 255, center + step - 1 );
+		}
+	}
+	return best;
+}
+
+// -----------------------------------------------------------
+// DrawLines
+// Render lines first..last-1 on top of the screen, in order.
+// With WU_BATCH the lines go through the lockstep rasterizer in
+// batches aligned to multiples of 8, so every caller composites
+// the same image as long as 'first' is a multiple of 8 too.
+// -----------------------------------------------------------
+void DrawLines( Surface* screen, int first, int last )
+{
+#if WU_BATCH && !defined( USE_ARM )
+	if (CPUCaps::HW_AVX2)
+	{
+		for (int j = first; j < last; j += 8) DrawWuLines8( screen, j, min( 8, last - j ) );
+		return;
+	}
+#endif
+#if TILED_MT
+	// not worth dispatching for a handful of lines
+	if (last - first >= 64)
+	{
+		DrawLinesTiled( screen, first, last );
+		return;
+	}
+#endif
+#if SPAN_CACHE
+	for (int j = first; j < last; j++) DrawSpan( screen, j );
+#elif WU_OCTANT
+	for (int j = first; j < last; j++) DrawWuLineT( screen, lx1[j], ly1[j], lx2[j], ly2[j], lc[j] );
+#else
+	for (int j = first; j < last; j++)
+	{
+		DrawWuLine( screen, lx1[j], ly1[j], lx2[j], ly2[j], lc[j] );
+	}
+#endif
+}
+
+// -----------------------------------------------------------
+// Fitness evaluation
+// Compare current generation against reference image.
+// -----------------------------------------------------------
+int Game::Evaluate()
+{
+#if SIMD_EVAL || METRIC != METRIC_RGB || ROI_MASK
+	static __int64 rows[SCRHEIGHT];
+	return (int)(ScoreRows( screen, { 0, 0, SCRWIDTH - 1, SCRHEIGHT - 1 }, 0, 0, rows ) >> 5);
+#else
+	const uint count = SCRWIDTH * SCRHEIGHT;
+	__int64 diff = 0;
+	for( uint i = 0; i < count; i++ )
+	{
+		uint src = screen->pixels[i / SCRWIDTH][i % SCRWIDTH];
+		uint ref = reference->pixels[i / SCRWIDTH][i % SCRWIDTH];
+		int r0 = (src >> 16) & 255, g0 = (src >> 8) & 255, b0 = src & 255;
+		int r1 = ref >> 16, g1 = (ref >> 8) & 255, b1 = ref & 255;
+		int dr = r0 - r1, dg = g0 - g1, db = b0 - b1;
+		// calculate squared color difference;
+		// take into account eye sensitivity to red, green and blue
+		diff += 3 * dr * dr + 6 * dg * dg + db * db;
+	}
+	return (int)(diff >> 5);
+#endif
+}
+
+// -----------------------------------------------------------
+// Prefix snapshots
+// The classic path rebuilds the prefix, lines 0..lidx-1, every tick.
+// The composited prefix at every SNAPSHOT_EVERY-th line is kept in a
+// ring of as many canvases as fit in SNAPSHOT_MB, so a prefix starts
+// from the nearest snapshot below it instead of from white. Accepting
+// a mutation of line i makes the snapshots above i stale; that is
+// only checked when a snapshot is about to be used.
+// -----------------------------------------------------------
+#define SNAPSHOT_EVERY	64										// a multiple of 8, so WU_BATCH batches stay aligned
+#define SNAPSHOT_MB		32
+#define SNAPSHOT_SLOTS	max( 1, (SNAPSHOT_MB << 20) / (SCRWIDTH * SCRHEIGHT * 4) )
+
+struct PrefixCache
+{
+	struct Snapshot
+	{
+		int line = -1;											// lines 0..line-1 are composited in
+		int stamp = 0;											// edits when it was taken
+		vector<uint> pixels;
+	};
+	// render lines 0..last-1 into screen; returns the number of lines drawn
+	int Prefix( Surface* screen, int last )
+	{
+		// the newest edit below each line, to tell which snapshots are stale
+		static int newest[LINES + 1];
+		newest[0] = 0;
+		for (int j = 0; j < last; j++) newest[j + 1] = max( newest[j], edit[j] );
+		const Snapshot* start = 0;
+		for (const Snapshot& s : ring)
+			if (s.line >= 0 && s.line <= last && newest[s.line] <= s.stamp && (!start || s.line > start->line)) start = &s;
+		int first = 0;
+		if (start)
+		{
+			first = start->line;
+			for (int y = 0; y < SCRHEIGHT; y++)
+				copy( &start->pixels[y * SCRWIDTH], &start->pixels[(y + 1) * SCRWIDTH], screen->pixels[y].begin() );
+		}
+		else for (int y = 0; y < SCRHEIGHT; y++) fill( screen->pixels[y].begin(), screen->pixels[y].end(), 0xFFFFFFFF );
+		// draw the rest, taking snapshots on the way
+		for (int j = first; j < last;)
+		{
+			const int next = min( last, (j / SNAPSHOT_EVERY + 1) * SNAPSHOT_EVERY );
+			DrawLines( screen, j, next );
+			j = next;
+			if (j % SNAPSHOT_EVERY == 0) Take( screen, j );
+		}
+		return last - first;
+	}
+	void Take( Surface* screen, int line )
+	{
+		// replace a stale snapshot of the same line, or the oldest one
+		Snapshot* s = &ring[next];
+		for (Snapshot& t : ring) if (t.line == line) s = &t;
+		if (s == &ring[next]) next = (next + 1) % ring.size();
+		s->line = line, s->stamp = edits;
+		s->pixels.resize( SCRWIDTH * SCRHEIGHT );
+		for (int y = 0; y < SCRHEIGHT; y++) copy( screen->pixels[y].begin(), screen->pixels[y].end(), &s->pixels[y * SCRWIDTH] );
+	}
+	// line i changed
+	void Edited( int i ) { edit[i] = ++edits; }
+	vector<Snapshot> ring = vector<Snapshot>( SNAPSHOT_SLOTS );
+	int next = 0;												// ring slot to take next
+	int edit[LINES] = {}, edits = 0;							// last edit per line, edit count
+} prefixCache;
+
+// -----------------------------------------------------------
+// Bounded fitness evaluation
+// A classic-path candidate differs from the accepted generation only
+// in rows y1..y2, the bounds of the mutated line before and after,
+// so the other rows keep the error cached for the accepted frame.
+// Rows y1..y2 are scanned in blocks; error only grows, so the scan
+// stops once the candidate can no longer beat bound. An early exit
+// returns a value >= bound.
+// -----------------------------------------------------------
+#define BOUND_BLOCK	16
+__int64 rowError[SCRHEIGHT], rowCandidate[SCRHEIGHT];		// per-row error: accepted frame, candidate
+int candidateY1 = 0, candidateY2 = -1;						// rows of rowCandidate that are complete
+
+int Game::Evaluate( int bound, int y1, int y2 )
+{
+	y1 = max( 0, y1 - metric->Radius() ), y2 = min( SCRHEIGHT - 1, y2 + metric->Radius() );
+	__int64 diff = 0;
+	for (int y = 0; y < y1; y++) diff += rowError[y];
+	for (int y = y2 + 1; y < SCRHEIGHT; y++) diff += rowError[y];
+	candidateY1 = y1, candidateY2 = -1;
+	for (int block = y1; block <= y2; block += BOUND_BLOCK)
+	{
+		diff += metric->RowsError( screen, block, min( y2, block + BOUND_BLOCK - 1 ), rowCandidate + block );
+		if ((int)(diff >> 5) >= bound) return (int)(diff >> 5);
+	}
+	candidateY2 = y2;
+	return (int)(diff >> 5);
+}
+
+// the last fully scanned candidate was accepted
+void AcceptRows()
+{
+	for (int y = candidateY1; y <= candidateY2; y++) rowError[y] = rowCandidate[y];
+}
+
+// -----------------------------------------------------------
+// Self checks
+// With SELF_CHECK, Init runs the fast paths against the reference
+// ones on inputs chosen to hit their edge cases, and prints what
+// does not match.
+// - Blend: the integer blends stay within 1 LSB of BlendDouble, also
+//   where line and background have the same integer luma.
+// - Sample rows: with a region of interest whose top is not on the
+//   sample grid, RenderRect<SAMPLE_STEP> renders exactly the rows
+//   SampleRejects scores.
+// -----------------------------------------------------------
+void CheckBlend()
+{
+	uint seed = 0x5EED, tested = 0, off = 0;
+	for (int k = 0; tested < 100000; k++)
+	{
+		// a line, and a background with the same integer luma
+		const uint line = k ? RandomUInt( seed ) & 0xffffff : 0x4e960a, rg = k ? RandomUInt( seed ) & 0xffff : 0x06fa;
+		const int rest = GrayFixed( line ) - GetRValue( rg ) * 299 - GetGValue( rg ) * 587;
+		if (rest < 0 || rest % 114 || rest / 114 > 255) continue;
+		const uint bg = rg | (rest / 114) << 16, w = k ? RandomUInt( seed ) & 255 : 109;
+		const uint d = BlendDouble( bg, line, GrayDouble( line ), w );
+		const uint f = BlendFixed( bg, line, GrayFixed( line ), w ), l = BlendLUT( bg, line, GrayFixed( line ), w );
+		bool ok = true;
+		for (int c = 0; c < 24; c += 8)
+		{
+			const int ref = (d >> c) & 255;
+			ok &= abs( (int)((f >> c) & 255) - ref ) <= 1 && abs( (int)((l >> c) & 255) - ref ) <= 1;
+		}
+		off += !ok, tested++;
+	}
+	printf( "self check: blend ties: %u of %u blends off by more than 1 LSB\n", off, tested );
+}
+
+#if ROI_MASK
+void CheckSampleRows()
+{
+	// a region of interest starting 3 rows into the rectangle
+	const Rect rect = { 100, 10, 300, 60 }, area = { 50, 13, 350, 200 };
+	RegionOfInterest test;
+	test.active = true, test.mask.assign( SCRWIDTH * SCRHEIGHT, ROI_SKIP );
+	for (int y = area.y1; y <= area.y2; y++) fill( &test.mask[y * SCRWIDTH + area.x1], &test.mask[y * SCRWIDTH + area.x2 + 1], ROI_SCORE );
+	test.Build( 0 );
+	swap( roi, test );
+	Surface* scratch = new Surface( SCRWIDTH, SCRHEIGHT );
+	const uint untouched = 0x123456;
+	for (int y = 0; y < SCRHEIGHT; y++) fill( scratch->pixels[y].begin(), scratch->pixels[y].end(), untouched );
+	RenderRect<SAMPLE_STEP>( scratch, rect, 0 );
+	int wrong = 0;
+	for (int y = area.y1; y <= rect.y2; y++)
+	{
+		const bool sampled = (y - rect.y1) % SAMPLE_STEP == 0;
+		for (int x = rect.x1; x <= rect.x2; x++) wrong += (scratch->pixels[y][x] != untouched) != sampled;
+	}
+	delete scratch;
+	swap( roi, test );
+	printf( "self check: sample rows: %i pixels rendered off the sampled rows or missed on them\n", wrong );
+}
+#endif
+
+void SelfCheck()
+{
+	CheckBlend();
+#if ROI_MASK
+	CheckSampleRows();
+#endif
+}
+
+// -----------------------------------------------------------
+// Application initialization
+// Load a previously saved generation, if available.
+// -----------------------------------------------------------
+void Game::Init()
+{
+	for (int i = 0; i < LINES; i++) MutateLine( i, seed );
+	FILE* f = fopen( LINEFILE, "rb" );
+	if (f)
+	{
+		fread( lx1, 4, LINES, f );
+		fread( ly1, 4, LINES, f );
+		fread( lx2, 4, LINES, f );
+		fread( ly2, 4, LINES, f );
+		fread( lc, 4, LINES, f );
+		fclose( f );
+	}
+	reference = new Surface( REFFILE );
+	backup = new Surface( SCRWIDTH, SCRHEIGHT );
+
+	for (int y = 0; y < SCRHEIGHT; y++)
+		for (int x = 0; x < SCRWIDTH; x++)
+			screen->pixels[y][x] = 0xFFFFFFFF;
+
+	DrawLines( screen, 0, LINES );
+	if (METRIC == METRIC_LAB) metric = new LabMetric();
+	else if (METRIC == METRIC_SSIM) metric = new SSIMMetric();
+	else metric = new RGBMetric();
+	metric->Init();
+	policy = NewAcceptance();
+#if SELF_CHECK
+	SelfCheck();
+#endif
+#if ROI_MASK
+	roi.Init( REFFILE, metric->Radius() );
+#endif
+	fitness = Evaluate();
+#if EVAL_BOUND
+	ScoreRows( screen, { 0, 0, SCRWIDTH - 1, SCRHEIGHT - 1 }, 0, 0, rowError );
+#endif
+#if DIRTY_RECT
+	canvas = new Surface( SCRWIDTH, SCRHEIGHT );
+	screen->CopyTo( canvas, 0, 0 );
+	errors.Init( canvas );
+	for (int i = 0; i < LINES; i++) IndexLine( i );
+	for (int level = 0; level < PYRAMID; level++) pyramid[level].Init( PYRAMID - level );
+#if CANDIDATES > 1
+	for (int i = 0; i < LINES; i++) GetSpan( i );
+	for (int n = 0; n < CANDIDATES; n++) candidate[n].Init( n );
+#endif
+#if ISLANDS > 1
+	for (int n = 0; n < ISLANDS; n++) island[n].Init( n, &island[(n + 1) % ISLANDS].inbox );
+#endif
+#endif
+}
+
+// -----------------------------------------------------------
+// Main application tick function
+// -----------------------------------------------------------
+void Game::Tick( float /* deltaTime */ )
+{
+	timer.reset();
+	int lineCount = 0;
+	int iterCount = 0;
+
+#if ISLANDS > 1
+	lineCount += StepIslands( screen, iterCount );
+	if (showHeatmap) SyncErrors(), DrawHeatmap( screen );
+#elif DIRTY_RECT
+	// canvas always holds the accepted generation; a candidate only
+	// re-renders the rectangle covering the old and new line
+	static vector<uint> saved;
+	for (int k = 0; k < ITERATIONS; k++)
+	{
+#if CANDIDATES > 1
+		lineCount += StepCandidates();
+#if SPECULATIVE
+		lidx = (lidx + CANDIDATES - 1) % LINES;				// the other lines of this step
+#endif
+#else
+		const Rect before = LineBounds( lidx );
+		const Mutation m = MutateLine( lidx, seed, backup );
+		const Rect r = Union( before, LineBounds( lidx ) );
+		const int bound = policy->Bound( fitness, seed );
+		const __int64 slack = (__int64)(bound - fitness) << 5;
+		IndexLine( lidx );
+#if ROI_MASK
+		// nothing the line covers is looked at: a change of 0, which the
+		// policy accepts or rejects like any other
+		if (!roi.Touches( r ))
+		{
+			if (fitness < bound) best.Leave( fitness, m );
+			else
+			{
+				UndoMutation( m );
+				IndexLine( lidx );
+			}
+		}
+		else
+#endif
+#if PYRAMID
+		if (!PyramidAccepts( r, slack ))
+		{
+			UndoMutation( m );
+			IndexLine( lidx );
+		}
+		else
+#endif
+		{
+			saved.clear();
+			for (int y = r.y1; y <= r.y2; y++)
+				saved.insert( saved.end(), canvas->pixels[y].begin() + r.x1, canvas->pixels[y].begin() + r.x2 + 1 );
+#if SAMPLE_EVAL
+			const bool lost = SampleRejects( canvas, r, slack );
+#else
+			const bool lost = false;
+#endif
+			if (!lost) lineCount += RenderRect( canvas, r, LINES );
+			const __int64 sum = lost ? 0 : errors.total + errors.Stage( canvas, r );
+			if (!lost && (int)(sum >> 5) < bound)
+			{
+				if ((int)(sum >> 5) >= fitness) best.Leave( fitness, m );
+				errors.Commit(), fitness = (int)(sum >> 5);
+			}
+			else
+			{
+				errors.Rollback();
+#if PYRAMID
+				PyramidReject();
+#endif
+				// restore the rectangle and the line
+				const uint* p = saved.data();
+				for (int y = r.y1; y <= r.y2; y++, p += r.x2 - r.x1 + 1)
+					copy( p, p + r.x2 - r.x1 + 1, canvas->pixels[y].begin() + r.x1 );
+				UndoMutation( m );
+				IndexLine( lidx );
+			}
+		}
+#endif
+		policy->Step( fitness, CANDIDATES );				// mutations scored this step
+		lidx = (lidx + 1) % LINES;
+		iterCount++;
+	}
+	canvas->CopyTo( screen, 0, 0 );
+	if (showHeatmap) DrawHeatmap( screen );
+#else
+	// draw up to lidx
+	int base = lidx;
+#if WU_BATCH
+	base &= ~7; // keep batches aligned, so every frame composites the same way
+#endif
+#if PREFIX_CACHE
+	lineCount += prefixCache.Prefix( screen, base );
+#else
+	for (int y = 0; y < SCRHEIGHT; y++)
+		for (int x = 0; x < SCRWIDTH; x++)
+			screen->pixels[y][x] = 0xFFFFFFFF;
+	DrawLines( screen, 0, base );
+	lineCount += base;
+#endif
+	screen->CopyTo( backup, 0, 0 );
+	// iterate and draw from lidx to end
+	for (int k = 0; k < ITERATIONS; k++)
+	{
+		backup->CopyTo( screen, 0, 0 );
+		const Rect before = LineBounds( lidx );
+		const Mutation m = MutateLine( lidx, seed, backup );
+		const int bound = policy->Bound( fitness, seed );
+		DrawLines( screen, base, LINES );
+		lineCount += LINES - base;
+#if EVAL_BOUND
+		const Rect r = Union( before, LineBounds( lidx ) );
+		int diff = Evaluate( bound, r.y1, r.y2 );
+		if (diff < bound) AcceptRows();
+#else
+		int diff = Evaluate();
+#endif
+		if (diff < bound)
+		{
+			if (diff >= fitness) best.Leave( fitness, m );
+			fitness = diff;
+#if PREFIX_CACHE
+			prefixCache.Edited( lidx );
+#endif
+		}
+		else UndoMutation( m );
+		policy->Step( fitness );
+		lidx = (lidx + 1) % LINES;
+		iterCount++;
+	}
+#endif
+
+	// stats
+	char t[128];
+	float elapsed = timer.elapsed();
+	float lps = (float)lineCount / elapsed;
+	peak = max( lps, peak );
+	sprintf( t, "fitness: %i", fitness );
+	screen->Bar( 0, SCRHEIGHT - 33, 130, SCRHEIGHT - 1, 0 );
+	screen->Print( t, 2, SCRHEIGHT - 24, 0xffffff );
+	sprintf( t, "lps:     %5.2fK", lps );
+	screen->Print( t, 2, SCRHEIGHT - 16, 0xffffff );
+	sprintf( t, "ips:     %5.2f", (iterCount * 1000) / elapsed );
+	screen->Print( t, 2, SCRHEIGHT - 8, 0xffffff );
+	sprintf( t, "peak:    %5.2f", peak );
+	screen->Print( t, 2, SCRHEIGHT - 32, 0xffffff );
+}
+
+// -----------------------------------------------------------
+// Input
+// H toggles the error heatmap, M dumps it and reports the worst
+// tiles (DIRTY_RECT only: the heatmap comes from the error buffer).
+// -----------------------------------------------------------
+void Game::KeyDown( int key )
+{
+	if (key == 'H') showHeatmap = !showHeatmap;
+#if ISLANDS > 1
+	if (key == 'M') SyncErrors();
+#endif
+	if (key == 'M') DumpHeatmap( "heatmap.bin" ), ReportHeatmap();
 }
 
 // -----------------------------------------------------------
 // Application termination
-// Save the current generation, so we can continue later.
+// Save the best generation, so we can continue later.
 // -----------------------------------------------------------
 void Game::Shutdown()
 {
+	best.Restore( fitness );
 	FILE* f = fopen( LINEFILE, "wb" );
 	fwrite( lx1, 4, LINES, f );
 	fwrite( ly1, 4, LINES, f );
@@ -14,6 +14,7 @@ public:
 	void Init();
 	void Tick( float deltaTime );
 	int Evaluate();
+	int Evaluate( int bound, int y1, int y2 );
 	void Shutdown();
 	// input handling
 	void MouseUp( int ) { /* implement if you want to detect mouse button presses */ }
@@ -21,7 +22,7 @@ public:
 	void MouseMove( int x, int y ) { mousePos.x = x, mousePos.y = y; }
 	void MouseWheel( float ) { /* implement if you want to handle the mouse wheel */ }
 	void KeyUp( int ) { /* implement if you want to handle keys */ }
-	void KeyDown( int ) { /* implement if you want to handle keys */ }
+	void KeyDown( int key );
 	// data members
 	int2 mousePos;
 };
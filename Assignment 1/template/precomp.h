@@ -16,7 +16,11 @@
 #include <list>		 // standard template library std::list
 #include <algorithm> // standard algorithms for stl containers
 #include <string>	 // strings
-// #include <thread>			// currently unused; enable to use Windows threads.
+#include <thread>			// std::thread, used by the job manager
+#include <mutex>
+#include <condition_variable>
+#include <atomic>			// island mailboxes
+#include <climits>			// INT_MAX
 #include <math.h>	// c standard math library
 #include <assert.h> // runtime assertions
 
@@ -168,7 +172,10 @@ public:
 	void CreateAndStartThread( unsigned int threadId );
 	void Go();
 	void BackgroundTask();
-	//HANDLE m_GoSignal, m_ThreadHandle;
+	thread m_Thread;
+	mutex m_GoMutex;
+	condition_variable m_GoSignal;
+	bool m_Go = false;
 	int m_ThreadID;
 };
 class JobManager	// singleton class!
@@ -190,9 +197,9 @@ protected:
 	Job* GetNextJob();
 	static JobManager* m_JobManager;
 	Job* m_JobList[256];
-	//CRITICAL_SECTION m_CS;
-	//HANDLE m_ThreadDone[64];
-	unsigned int m_NumThreads, m_JobCount;
+	mutex m_CS, m_DoneMutex;
+	condition_variable m_ThreadDone;
+	unsigned int m_NumThreads, m_JobCount, m_DoneCount;
 	JobThread* m_JobThreadList;
 };
 
@@ -400,147 +400,107 @@ int main()
 }
 
 // Jobmanager implementation
-// DWORD JobThreadProc( LPVOID lpParameter )
-// {
-// 	JobThread* JobThreadInstance = (JobThread*)lpParameter;
-// 	if (JobThreadInstance /* just here to avoid 'unreachable code' warning */)
-// 		JobThreadInstance->BackgroundTask();
-// 	return 0;
-// }
-
-// void JobThread::CreateAndStartThread( unsigned int threadId )
-// {
-// 	m_GoSignal = CreateEvent( 0, FALSE, FALSE, 0 );
-// 	m_ThreadHandle = CreateThread( 0, 0, (LPTHREAD_START_ROUTINE)&JobThreadProc, (LPVOID)this, 0, 0 );
-// 	m_ThreadID = threadId;
-// }
-// void JobThread::BackgroundTask()
-// {
-// 	while (1)
-// 	{
-// 		WaitForSingleObject( m_GoSignal, INFINITE );
-// 		while (1)
-// 		{
-// 			Job* job = JobManager::GetJobManager()->GetNextJob();
-// 			if (!job)
-// 			{
-// 				JobManager::GetJobManager()->ThreadDone( m_ThreadID );
-// 				break;
-// 			}
-// 			job->RunCodeWrapper();
-// 		}
-// 	}
-// }
-
-// void JobThread::Go()
-// {
-// 	SetEvent( m_GoSignal );
-// }
+// Portable version of the original Windows job manager, on std::thread.
+void JobThread::CreateAndStartThread( unsigned int threadId )
+{
+	m_ThreadID = threadId;
+	m_Thread = thread( &JobThread::BackgroundTask, this );
+	m_Thread.detach();
+}
+void JobThread::BackgroundTask()
+{
+	while (1)
+	{
+		{
+			unique_lock<mutex> lock( m_GoMutex );
+			m_GoSignal.wait( lock, [this] { return m_Go; } );
+			m_Go = false;
+		}
+		while (1)
+		{
+			Job* job = JobManager::GetJobManager()->GetNextJob();
+			if (!job)
+			{
+				JobManager::GetJobManager()->ThreadDone( m_ThreadID );
+				break;
+			}
+			job->RunCodeWrapper();
+		}
+	}
+}
 
-// void Job::RunCodeWrapper()
-// {
-// 	Main();
-// }
+void JobThread::Go()
+{
+	lock_guard<mutex> lock( m_GoMutex );
+	m_Go = true;
+	m_GoSignal.notify_one();
+}
 
-// JobManager* JobManager::m_JobManager = 0;
+void Job::RunCodeWrapper()
+{
+	Main();
+}
 
-// JobManager::JobManager( unsigned int threads ) : m_NumThreads( threads )
-// {
-// 	InitializeCriticalSection( &m_CS );
-// }
+JobManager* JobManager::m_JobManager = 0;
 
-// JobManager::~JobManager()
-// {
-// 	DeleteCriticalSection( &m_CS );
-// }
+JobManager::JobManager( unsigned int threads ) : m_NumThreads( threads ), m_JobCount( 0 ), m_DoneCount( 0 ) {}
 
-// void JobManager::CreateJobManager( unsigned int numThreads )
-// {
-// 	m_JobManager = new JobManager( numThreads );
-// 	m_JobManager->m_JobThreadList = new JobThread[numThreads];
-// 	for (unsigned int i = 0; i < numThreads; i++)
-// 	{
-// 		m_JobManager->m_JobThreadList[i].CreateAndStartThread( i );
-// 		m_JobManager->m_ThreadDone[i] = CreateEvent( 0, FALSE, FALSE, 0 );
-// 	}
-// 	m_JobManager->m_JobCount = 0;
-// }
+JobManager::~JobManager()
+{
+	// worker threads are detached and live as long as the process
+}
 
-// void JobManager::AddJob2( Job* a_Job )
-// {
-// 	m_JobList[m_JobCount++] = a_Job;
-// }
+void JobManager::CreateJobManager( unsigned int numThreads )
+{
+	m_JobManager = new JobManager( numThreads );
+	m_JobManager->m_JobThreadList = new JobThread[numThreads];
+	for (unsigned int i = 0; i < numThreads; i++) m_JobManager->m_JobThreadList[i].CreateAndStartThread( i );
+}
 
-// Job* JobManager::GetNextJob()
-// {
-// 	Job* job = 0;
-// 	EnterCriticalSection( &m_CS );
-// 	if (m_JobCount > 0) job = m_JobList[--m_JobCount];
-// 	LeaveCriticalSection( &m_CS );
-// 	return job;
-// }
+void JobManager::AddJob2( Job* a_Job )
+{
+	m_JobList[m_JobCount++] = a_Job;
+}
 
-// void JobManager::RunJobs()
-// {
-// 	if (m_JobCount == 0) return;
-// 	for (unsigned int i = 0; i < m_NumThreads; i++) m_JobThreadList[i].Go();
-// 	WaitForMultipleObjects( m_NumThreads, m_ThreadDone, TRUE, INFINITE );
-// }
+Job* JobManager::GetNextJob()
+{
+	Job* job = 0;
+	lock_guard<mutex> lock( m_CS );
+	if (m_JobCount > 0) job = m_JobList[--m_JobCount];
+	return job;
+}
 
-// void JobManager::ThreadDone( unsigned int n )
-// {
-// 	SetEvent( m_ThreadDone[n] );
-// }
+void JobManager::RunJobs()
+{
+	if (m_JobCount == 0) return;
+	m_DoneCount = 0;
+	for (unsigned int i = 0; i < m_NumThreads; i++) m_JobThreadList[i].Go();
+	unique_lock<mutex> lock( m_DoneMutex );
+	m_ThreadDone.wait( lock, [this] { return m_DoneCount == m_NumThreads; } );
+}
 
-// DWORD CountSetBits( ULONG_PTR bitMask )
-// {
-// 	DWORD LSHIFT = sizeof( ULONG_PTR ) * 8 - 1, bitSetCount = 0;
-// 	ULONG_PTR bitTest = (ULONG_PTR)1 << LSHIFT;
-// 	for (DWORD i = 0; i <= LSHIFT; ++i) bitSetCount += ((bitMask & bitTest) ? 1 : 0), bitTest /= 2;
-// 	return bitSetCount;
-// }
+void JobManager::ThreadDone( unsigned int )
+{
+	lock_guard<mutex> lock( m_DoneMutex );
+	if (++m_DoneCount == m_NumThreads) m_ThreadDone.notify_one();
+}
 
-// void JobManager::GetProcessorCount( uint& cores, uint& logical )
-// {
-// 	// https://github.com/GPUOpen-LibrariesAndSDKs/cpu-core-counts
-// 	cores = logical = 0;
-// 	char* buffer = NULL;
-// 	DWORD len = 0;
-// 	if (FALSE == GetLogicalProcessorInformationEx( RelationAll, (PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX)buffer, &len ))
-// 	{
-// 		if (GetLastError() == ERROR_INSUFFICIENT_BUFFER)
-// 		{
-// 			buffer = (char*)malloc( len );
-// 			if (GetLogicalProcessorInformationEx( RelationAll, (PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX)buffer, &len ))
-// 			{
-// 				char* ptr = buffer;
-// 				while (ptr < buffer + len)
-// 				{
-// 					PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX pi = (PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX)ptr;
-// 					if (pi->Relationship == RelationProcessorCore)
-// 					{
-// 						cores++;
-// 						for (size_t g = 0; g < pi->Processor.GroupCount; ++g)
-// 							logical += CountSetBits( pi->Processor.GroupMask[g].Mask );
-// 					}
-// 					ptr += pi->Size;
-// 				}
-// 			}
-// 			free( buffer );
-// 		}
-// 	}
-// }
+void JobManager::GetProcessorCount( uint& cores, uint& logical )
+{
+	// the standard library only reports hardware threads
+	cores = logical = max( 1u, thread::hardware_concurrency() );
+}
 
-// JobManager* JobManager::GetJobManager()
-// {
-// 	if (!m_JobManager)
-// 	{
-// 		uint c, l;
-// 		GetProcessorCount( c, l );
-// 		CreateJobManager( l );
-// 	}
-// 	return m_JobManager;
-// }
+JobManager* JobManager::GetJobManager()
+{
+	if (!m_JobManager)
+	{
+		uint c, l;
+		GetProcessorCount( c, l );
+		CreateJobManager( l );
+	}
+	return m_JobManager;
+}
 
 // Helper functions
 // bool FileIsNewer( const char* file1, const char* file2 )